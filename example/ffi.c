@@ -1,4 +1,13 @@
 #include "ffi.h"
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 /*
  * @Description:
  * @Author: ekibun
@@ -37,19 +46,192 @@ DLLEXPORT JSValue *jsNULL()
   return _CPP_NEW_JSVALUE(JS_NULL);
 }
 
+/* open addressing map from byte strings to 64-bit values; keys are copied */
+typedef struct
+{
+  char *key;
+  size_t len;
+  uint32_t hash;
+  uint64_t value;
+} StrMapEntry;
+
+typedef struct
+{
+  StrMapEntry *entries;
+  uint32_t cap;
+  uint32_t count;
+} StrMap;
+
+uint32_t strmap_hash(const char *key, size_t len)
+{
+  uint32_t h = 2166136261u;
+  for (size_t i = 0; i < len; i++)
+    h = (h ^ (uint8_t)key[i]) * 16777619u;
+  return h;
+}
+
+StrMapEntry *strmap_find(StrMap *map, const char *key, size_t len)
+{
+  if (map->count == 0)
+    return NULL;
+  uint32_t hash = strmap_hash(key, len);
+  for (uint32_t i = hash & (map->cap - 1);; i = (i + 1) & (map->cap - 1))
+  {
+    StrMapEntry *e = &map->entries[i];
+    if (e->key == NULL)
+      return NULL;
+    if (e->hash == hash && e->len == len && memcmp(e->key, key, len) == 0)
+      return e;
+  }
+}
+
+int strmap_grow(StrMap *map)
+{
+  uint32_t cap = map->cap ? map->cap * 2 : 16;
+  StrMapEntry *entries = (StrMapEntry *)calloc(cap, sizeof(StrMapEntry));
+  if (entries == NULL)
+    return -1;
+  for (uint32_t i = 0; i < map->cap; i++)
+  {
+    StrMapEntry *e = &map->entries[i];
+    if (e->key == NULL)
+      continue;
+    uint32_t j = e->hash & (cap - 1);
+    while (entries[j].key)
+      j = (j + 1) & (cap - 1);
+    entries[j] = *e;
+  }
+  free(map->entries);
+  map->entries = entries;
+  map->cap = cap;
+  return 0;
+}
+
+/* insert or overwrite; returns the entry or NULL when out of memory */
+StrMapEntry *strmap_put(StrMap *map, const char *key, size_t len, uint64_t value)
+{
+  StrMapEntry *e = strmap_find(map, key, len);
+  if (e)
+  {
+    e->value = value;
+    return e;
+  }
+  if ((map->count + 1) * 2 > map->cap && strmap_grow(map))
+    return NULL;
+  char *copy = (char *)malloc(len + 1);
+  if (copy == NULL)
+    return NULL;
+  memcpy(copy, key, len);
+  copy[len] = '\0';
+  uint32_t hash = strmap_hash(key, len);
+  uint32_t i = hash & (map->cap - 1);
+  while (map->entries[i].key)
+    i = (i + 1) & (map->cap - 1);
+  e = &map->entries[i];
+  e->key = copy;
+  e->len = len;
+  e->hash = hash;
+  e->value = value;
+  map->count++;
+  return e;
+}
+
+/* backward-shift deletion keeps probe sequences intact without tombstones */
+void strmap_del(StrMap *map, StrMapEntry *e)
+{
+  uint32_t mask = map->cap - 1;
+  uint32_t i = (uint32_t)(e - map->entries);
+  free(e->key);
+  map->count--;
+  for (uint32_t j = (i + 1) & mask; map->entries[j].key; j = (j + 1) & mask)
+  {
+    uint32_t home = map->entries[j].hash & mask;
+    if (((j - home) & mask) >= ((j - i) & mask))
+    {
+      map->entries[i] = map->entries[j];
+      i = j;
+    }
+  }
+  map->entries[i].key = NULL;
+}
+
+void strmap_free(StrMap *map)
+{
+  for (uint32_t i = 0; i < map->cap; i++)
+    free(map->entries[i].key);
+  free(map->entries);
+  map->entries = NULL;
+  map->cap = 0;
+  map->count = 0;
+}
+
+/* builtin classes probed per runtime; the first entries are the typed arrays */
+enum JSBuiltinClass
+{
+  JSBuiltinClass_ARRAY_BUFFER = JSTypedArrayType_COUNT,
+  JSBuiltinClass_COUNT,
+};
+
+const char *js_builtin_class_ctors[JSBuiltinClass_COUNT] = {
+    "Uint8ClampedArray",
+    "Int8Array",
+    "Uint8Array",
+    "Int16Array",
+    "Uint16Array",
+    "Int32Array",
+    "Uint32Array",
+    "BigInt64Array",
+    "BigUint64Array",
+    "Float32Array",
+    "Float64Array",
+    "ArrayBuffer",
+};
+
+/* FIFO of host notifications; `ptrs` holds finalizer opaques or rejection contexts */
+typedef struct
+{
+  void **ptrs;
+  JSValue *values;
+  uint32_t capacity;
+  uint32_t high_water;
+  uint32_t start;
+  uint32_t end;
+  int32_t pending;
+} NotifyQueue;
+
 typedef struct
 {
   JSChannel *channel;
   int64_t timeout;
   int64_t start;
+  int32_t deadline_clock;
+  uint32_t check_stride;
+  uint32_t check_countdown;
+  volatile int32_t interrupt_requested;
+  int32_t builtin_class_probed;
+  JSClassID builtin_class_ids[JSBuiltinClass_COUNT];
+  StrMap atoms;
+  struct JSBundle *bundles;
+  StrMap module_names;
+  StrMap native_modules;
+  StrMap eval_index;
+  struct EvalCacheEntry *eval_head;
+  struct EvalCacheEntry *eval_tail;
+  uint32_t eval_count;
+  uint32_t eval_capacity;
+  NotifyQueue finalizers;
+  NotifyQueue rejections;
+  struct ClassExotic *class_exotics;
 } RuntimeOpaque;
 
 
 RuntimeOpaque* _CPP_NEW_RT(JSChannel *channel, int64_t timeout, int64_t start) {
     RuntimeOpaque rt;
+    memset(&rt, 0, sizeof(RuntimeOpaque));
     rt.channel = channel;
     rt.timeout = timeout;
     rt.start = start;
+    rt.check_stride = 1;
     RuntimeOpaque* ptr = (RuntimeOpaque*)malloc(sizeof(RuntimeOpaque));
     *ptr = rt;
     return ptr;
@@ -59,14 +241,806 @@ void _CPP_DELETE_RT(RuntimeOpaque* rtRef) {
     free(rtRef);
 }
 
+/* intrinsics captured before any script runs and can rebind the globals */
+typedef struct
+{
+  JSValue typed_array_ctors[JSTypedArrayType_COUNT];
+} ContextOpaque;
+
+/*
+ * Builtin class ids are internal to quickjs.c; learn them once per runtime
+ * from a throwaway instance of each constructor. The probe runs in a private
+ * context so scripts cannot substitute the constructors, and is retried
+ * until every class was learned.
+ */
+JSClassID js_builtin_class_id(JSContext *ctx, int32_t kind)
+{
+  JSRuntime *rt = JS_GetRuntime(ctx);
+  RuntimeOpaque *opaque = (RuntimeOpaque *)JS_GetRuntimeOpaque(rt);
+  if (opaque == NULL)
+    return 0;
+  if (!opaque->builtin_class_probed)
+  {
+    JSContext *probe = JS_NewContext(rt);
+    if (probe == NULL)
+      return 0;
+    JSValue global = JS_GetGlobalObject(probe);
+    JSValue zero = JS_NewInt32(probe, 0);
+    JSClassID ids[JSBuiltinClass_COUNT];
+    int ok = 1;
+    for (int32_t i = 0; i < JSBuiltinClass_COUNT; i++)
+    {
+      JSValue obj;
+      if (i == JSBuiltinClass_ARRAY_BUFFER)
+      {
+        obj = JS_NewArrayBufferCopy(probe, NULL, 0);
+      }
+      else
+      {
+        JSValue ctor = JS_GetPropertyStr(probe, global, js_builtin_class_ctors[i]);
+        obj = JS_CallConstructor(probe, ctor, 1, &zero);
+        JS_FreeValue(probe, ctor);
+      }
+      ids[i] = JS_IsException(obj) ? 0 : JS_GetClassID(obj);
+      if (ids[i] == 0)
+      {
+        ok = 0;
+        JS_FreeValue(probe, JS_GetException(probe));
+      }
+      JS_FreeValue(probe, obj);
+    }
+    JS_FreeValue(probe, global);
+    JS_FreeContext(probe);
+    if (!ok)
+      return 0;
+    memcpy(opaque->builtin_class_ids, ids, sizeof(ids));
+    opaque->builtin_class_probed = 1;
+  }
+  return opaque->builtin_class_ids[kind];
+}
+
+#ifdef _WIN32
+typedef SRWLOCK JSMutex;
+#define JS_MUTEX_INIT SRWLOCK_INIT
+#define js_mutex_lock(m) AcquireSRWLockExclusive(m)
+#define js_mutex_unlock(m) ReleaseSRWLockExclusive(m)
+#else
+typedef pthread_mutex_t JSMutex;
+#define JS_MUTEX_INIT PTHREAD_MUTEX_INITIALIZER
+#define js_mutex_lock(m) pthread_mutex_lock(m)
+#define js_mutex_unlock(m) pthread_mutex_unlock(m)
+#endif
+
+typedef struct
+{
+  uint8_t *data;
+  size_t size;
+#ifdef _WIN32
+  HANDLE mapping;
+#endif
+} MappedFile;
+
+int js_map_file(const char *path, MappedFile *mf)
+{
+#ifdef _WIN32
+  HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+  if (file == INVALID_HANDLE_VALUE)
+    return -1;
+  LARGE_INTEGER size;
+  mf->mapping = NULL;
+  if (GetFileSizeEx(file, &size) && size.QuadPart > 0)
+    mf->mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+  CloseHandle(file);
+  if (mf->mapping == NULL)
+    return -1;
+  mf->data = (uint8_t *)MapViewOfFile(mf->mapping, FILE_MAP_READ, 0, 0, 0);
+  if (mf->data == NULL)
+  {
+    CloseHandle(mf->mapping);
+    return -1;
+  }
+  mf->size = (size_t)size.QuadPart;
+  return 0;
+#else
+  int fd = open(path, O_RDONLY);
+  if (fd < 0)
+    return -1;
+  struct stat st;
+  void *data = MAP_FAILED;
+  if (fstat(fd, &st) == 0 && st.st_size > 0)
+    data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED)
+    return -1;
+  mf->data = (uint8_t *)data;
+  mf->size = st.st_size;
+  return 0;
+#endif
+}
+
+void js_unmap_file(MappedFile *mf)
+{
+#ifdef _WIN32
+  UnmapViewOfFile(mf->data);
+  CloseHandle(mf->mapping);
+#else
+  munmap(mf->data, mf->size);
+#endif
+}
+
+/* write `head` then `data` to a temporary file and rename it over `path` */
+int js_write_file_atomic(const char *path, const void *head, size_t head_size, const uint8_t *data, size_t size)
+{
+  char tmp[4096];
+#ifdef _WIN32
+  int n = snprintf(tmp, sizeof(tmp), "%s.%lu.%lu.tmp", path, GetCurrentProcessId(), GetCurrentThreadId());
+#else
+  int n = snprintf(tmp, sizeof(tmp), "%s.%ld.%p.tmp", path, (long)getpid(), (void *)&tmp);
+#endif
+  if (n < 0 || (size_t)n >= sizeof(tmp))
+    return -1;
+  FILE *f = fopen(tmp, "wb");
+  if (f == NULL)
+    return -1;
+  int ok = fwrite(head, 1, head_size, f) == head_size && fwrite(data, 1, size, f) == size;
+  ok = fclose(f) == 0 && ok;
+#ifdef _WIN32
+  ok = ok && MoveFileExA(tmp, path, MOVEFILE_REPLACE_EXISTING);
+#else
+  ok = ok && rename(tmp, path) == 0;
+#endif
+  if (!ok)
+    remove(tmp);
+  return ok ? 0 : -1;
+}
+
+uint64_t js_hash64(uint64_t h, const void *data, size_t len)
+{
+  const uint8_t *p = (const uint8_t *)data;
+  for (size_t i = 0; i < len; i++)
+    h = (h ^ p[i]) * 1099511628211ull;
+  return h;
+}
+
+/*
+ * Process-wide LRU of module bytecode keyed by module name and source hash,
+ * optionally backed by a directory of bytecode files. Entries are
+ * reference counted so JS_ReadObject runs outside the lock.
+ */
+typedef struct ModuleCacheEntry
+{
+  struct ModuleCacheEntry *prev;
+  struct ModuleCacheEntry *next;
+  const char *key;
+  size_t key_len;
+  int32_t refs;
+  int32_t evicted;
+  size_t size;
+  uint8_t data[1];
+} ModuleCacheEntry;
+
+typedef struct
+{
+  JSMutex lock;
+  StrMap index;
+  ModuleCacheEntry *head;
+  ModuleCacheEntry *tail;
+  size_t bytes;
+  size_t capacity;
+  char *dir;
+} ModuleCache;
+
+ModuleCache js_module_cache = {JS_MUTEX_INIT};
+
+void js_module_cache_unlink(ModuleCacheEntry *e)
+{
+  ModuleCache *mc = &js_module_cache;
+  if (e->prev)
+    e->prev->next = e->next;
+  else
+    mc->head = e->next;
+  if (e->next)
+    e->next->prev = e->prev;
+  else
+    mc->tail = e->prev;
+  e->prev = e->next = NULL;
+}
+
+void js_module_cache_evict(size_t capacity)
+{
+  ModuleCache *mc = &js_module_cache;
+  while (mc->tail && mc->bytes > capacity)
+  {
+    ModuleCacheEntry *e = mc->tail;
+    js_module_cache_unlink(e);
+    strmap_del(&mc->index, strmap_find(&mc->index, e->key, e->key_len));
+    mc->bytes -= e->size;
+    e->evicted = 1;
+    if (e->refs == 0)
+      free(e);
+  }
+}
+
+void js_module_cache_release(ModuleCacheEntry *e)
+{
+  js_mutex_lock(&js_module_cache.lock);
+  if (--e->refs == 0 && e->evicted)
+    free(e);
+  js_mutex_unlock(&js_module_cache.lock);
+}
+
+ModuleCacheEntry *js_module_cache_acquire(const char *key, size_t key_len)
+{
+  ModuleCache *mc = &js_module_cache;
+  StrMapEntry *slot = strmap_find(&mc->index, key, key_len);
+  if (slot == NULL)
+    return NULL;
+  ModuleCacheEntry *e = (ModuleCacheEntry *)(uintptr_t)slot->value;
+  js_module_cache_unlink(e);
+  e->next = mc->head;
+  if (mc->head)
+    mc->head->prev = e;
+  mc->head = e;
+  if (mc->tail == NULL)
+    mc->tail = e;
+  e->refs++;
+  return e;
+}
+
+void js_module_cache_insert(const char *key, size_t key_len, const uint8_t *data, size_t size)
+{
+  ModuleCache *mc = &js_module_cache;
+  if (size > mc->capacity || strmap_find(&mc->index, key, key_len))
+    return;
+  ModuleCacheEntry *e = (ModuleCacheEntry *)malloc(sizeof(ModuleCacheEntry) + size);
+  if (e == NULL)
+    return;
+  memcpy(e->data, data, size);
+  e->size = size;
+  e->refs = 0;
+  e->evicted = 0;
+  e->prev = NULL;
+  StrMapEntry *slot = strmap_put(&mc->index, key, key_len, (uintptr_t)e);
+  if (slot == NULL)
+  {
+    free(e);
+    return;
+  }
+  /* the map's key copy stays put while its slot moves around */
+  e->key = slot->key;
+  e->key_len = key_len;
+  e->next = mc->head;
+  if (mc->head)
+    mc->head->prev = e;
+  mc->head = e;
+  if (mc->tail == NULL)
+    mc->tail = e;
+  mc->bytes += size;
+  js_module_cache_evict(mc->capacity);
+}
+
+DLLEXPORT void jsSetModuleCacheCapacity(size_t max_bytes)
+{
+  js_mutex_lock(&js_module_cache.lock);
+  js_module_cache.capacity = max_bytes;
+  js_module_cache_evict(max_bytes);
+  js_mutex_unlock(&js_module_cache.lock);
+}
+
+DLLEXPORT void jsSetModuleCacheDir(const char *dir)
+{
+  char *copy = NULL;
+  if (dir && *dir)
+  {
+    copy = (char *)malloc(strlen(dir) + 1);
+    if (copy)
+      strcpy(copy, dir);
+  }
+  js_mutex_lock(&js_module_cache.lock);
+  free(js_module_cache.dir);
+  js_module_cache.dir = copy;
+  js_mutex_unlock(&js_module_cache.lock);
+}
+
+/*
+ * Identifies the engine build. JS_ReadObject trusts the bytecode it is
+ * given and only checks BC_VERSION, which does not change with the opcode
+ * set (e.g. CONFIG_BIGNUM) or a rebuild, so cached bytecode is only reused
+ * by the exact build that wrote it. Define JS_BUILD_ID for reproducible builds.
+ */
+#ifndef JS_BUILD_ID
+#define JS_BUILD_ID __DATE__ " " __TIME__
+#endif
+
+const char js_build_id[] = JS_BUILD_ID
+#ifdef CONFIG_VERSION
+    " " CONFIG_VERSION
+#endif
+#ifdef CONFIG_BIGNUM
+    " bignum"
+#endif
+#ifdef __VERSION__
+    " " __VERSION__
+#endif
+    ;
+
+uint64_t js_build_hash()
+{
+  uint32_t endian = 1;
+  uint32_t abi[3] = {(uint32_t)sizeof(void *), (uint32_t)sizeof(JSValue), *(uint8_t *)&endian};
+  uint64_t h = js_hash64(1469598103934665603ull, js_build_id, sizeof(js_build_id));
+  return js_hash64(h, abi, sizeof(abi));
+}
+
+#define JS_MODULE_CACHE_MAGIC "QJSC"
+
+/* prefix of every bytecode file in the cache directory */
+typedef struct
+{
+  char magic[4];
+  uint32_t reserved;
+  uint64_t build;
+  uint64_t size;
+  uint64_t checksum;
+} ModuleCacheHeader;
+
+/* returns the bytecode of a cache file, or NULL when it is foreign, truncated or corrupt */
+const uint8_t *js_module_cache_verify(const uint8_t *data, size_t size, size_t *psize)
+{
+  ModuleCacheHeader header;
+  if (size < sizeof(ModuleCacheHeader))
+    return NULL;
+  memcpy(&header, data, sizeof(ModuleCacheHeader));
+  data += sizeof(ModuleCacheHeader);
+  size -= sizeof(ModuleCacheHeader);
+  if (memcmp(header.magic, JS_MODULE_CACHE_MAGIC, 4) || header.build != js_build_hash() ||
+      header.size != size || header.checksum != js_hash64(1469598103934665603ull, data, size))
+    return NULL;
+  *psize = size;
+  return data;
+}
+
+JSValue js_module_read_bytecode(JSContext *ctx, const uint8_t *data, size_t size)
+{
+  JSValue val = JS_ReadObject(ctx, data, size, JS_READ_OBJ_BYTECODE);
+  if (JS_IsException(val))
+  {
+    JS_FreeValue(ctx, JS_GetException(ctx));
+    return JS_UNDEFINED;
+  }
+  if (JS_VALUE_GET_TAG(val) != JS_TAG_MODULE)
+  {
+    JS_FreeValue(ctx, val);
+    return JS_UNDEFINED;
+  }
+  return val;
+}
+
+/* compile a module, going through the bytecode cache when it is enabled */
+JSValue js_compile_module(JSContext *ctx, const char *module_name, const char *src, size_t len)
+{
+  ModuleCache *mc = &js_module_cache;
+  size_t name_len = strlen(module_name);
+  js_mutex_lock(&mc->lock);
+  int enabled = (mc->capacity > 0 || mc->dir != NULL) && name_len < 4096;
+  js_mutex_unlock(&mc->lock);
+  if (!enabled)
+    return JS_Eval(ctx, src, len, module_name, JS_EVAL_TYPE_MODULE | JS_EVAL_FLAG_COMPILE_ONLY);
+
+  /* the source hash is seeded with the engine build, as bytecode is not portable across builds */
+  uint64_t build = js_build_hash();
+  uint64_t src_hash = js_hash64(1469598103934665603ull, &build, sizeof(build));
+  src_hash = js_hash64(src_hash, src, len);
+  char key[4096 + 24];
+  memcpy(key, module_name, name_len);
+  key[name_len] = '\0';
+  size_t key_len = name_len + 1 + snprintf(key + name_len + 1, 24, "%016llx", (unsigned long long)src_hash);
+
+  char path[4096];
+  path[0] = '\0';
+  js_mutex_lock(&mc->lock);
+  if (mc->dir)
+  {
+    int n = snprintf(path, sizeof(path), "%s/%016llx-%016llx.qjsbc", mc->dir,
+                     (unsigned long long)js_hash64(1469598103934665603ull, module_name, name_len),
+                     (unsigned long long)src_hash);
+    /* a truncated path would name some other file, so skip the disk cache */
+    if (n < 0 || (size_t)n >= sizeof(path))
+      path[0] = '\0';
+  }
+  ModuleCacheEntry *e = js_module_cache_acquire(key, key_len);
+  js_mutex_unlock(&mc->lock);
+  if (e)
+  {
+    JSValue val = js_module_read_bytecode(ctx, e->data, e->size);
+    js_module_cache_release(e);
+    if (!JS_IsUndefined(val))
+      return val;
+  }
+
+  MappedFile mf;
+  if (path[0] && js_map_file(path, &mf) == 0)
+  {
+    size_t size = 0;
+    const uint8_t *data = js_module_cache_verify(mf.data, mf.size, &size);
+    JSValue val = data ? js_module_read_bytecode(ctx, data, size) : JS_UNDEFINED;
+    if (!JS_IsUndefined(val))
+    {
+      js_mutex_lock(&mc->lock);
+      js_module_cache_insert(key, key_len, data, size);
+      js_mutex_unlock(&mc->lock);
+    }
+    js_unmap_file(&mf);
+    if (!JS_IsUndefined(val))
+      return val;
+  }
+
+  JSValue val = JS_Eval(ctx, src, len, module_name, JS_EVAL_TYPE_MODULE | JS_EVAL_FLAG_COMPILE_ONLY);
+  if (JS_IsException(val))
+    return val;
+  size_t size;
+  uint8_t *data = JS_WriteObject(ctx, &size, val, JS_WRITE_OBJ_BYTECODE);
+  if (data == NULL)
+  {
+    JS_FreeValue(ctx, JS_GetException(ctx));
+    return val;
+  }
+  js_mutex_lock(&mc->lock);
+  js_module_cache_insert(key, key_len, data, size);
+  js_mutex_unlock(&mc->lock);
+  if (path[0])
+  {
+    ModuleCacheHeader header;
+    memset(&header, 0, sizeof(ModuleCacheHeader));
+    memcpy(header.magic, JS_MODULE_CACHE_MAGIC, 4);
+    header.build = build;
+    header.size = size;
+    header.checksum = js_hash64(1469598103934665603ull, data, size);
+    js_write_file_atomic(path, &header, sizeof(header), data, size);
+  }
+  js_free(ctx, data);
+  return val;
+}
+
+/* a registered bundle file; every entry is bounds-checked on registration */
+typedef struct JSBundle
+{
+  struct JSBundle *next;
+  MappedFile file;
+  const JSBundleEntry *entries;
+  uint32_t count;
+} JSBundle;
+
+DLLEXPORT int32_t jsRegisterBundle(JSRuntime *rt, const char *path)
+{
+  RuntimeOpaque *opaque = (RuntimeOpaque *)JS_GetRuntimeOpaque(rt);
+  JSBundle *bundle = (JSBundle *)malloc(sizeof(JSBundle));
+  if (opaque == NULL || bundle == NULL || js_map_file(path, &bundle->file))
+  {
+    free(bundle);
+    return -1;
+  }
+  const uint8_t *data = bundle->file.data;
+  uint64_t size = bundle->file.size;
+  JSBundleHeader header;
+  int ok = size >= sizeof(JSBundleHeader);
+  if (ok)
+  {
+    memcpy(&header, data, sizeof(JSBundleHeader));
+    ok = memcmp(header.magic, JS_BUNDLE_MAGIC, 4) == 0 && header.version == JS_BUNDLE_VERSION &&
+         header.count <= (size - sizeof(JSBundleHeader)) / sizeof(JSBundleEntry);
+  }
+  bundle->entries = (const JSBundleEntry *)(data + sizeof(JSBundleHeader));
+  bundle->count = ok ? header.count : 0;
+  for (uint32_t i = 0; ok && i < bundle->count; i++)
+  {
+    const JSBundleEntry *e = &bundle->entries[i];
+    ok = e->name_offset <= size && e->name_len <= size - e->name_offset &&
+         e->data_offset <= size && e->data_len <= size - e->data_offset;
+    if (ok && i > 0)
+    {
+      /* js_bundle_load binary-searches, so names must be strictly increasing */
+      const JSBundleEntry *prev = &bundle->entries[i - 1];
+      int cmp = memcmp(data + prev->name_offset, data + e->name_offset,
+                       prev->name_len < e->name_len ? prev->name_len : e->name_len);
+      if (cmp == 0)
+        cmp = prev->name_len < e->name_len ? -1 : prev->name_len > e->name_len;
+      ok = cmp < 0;
+    }
+  }
+  if (!ok)
+  {
+    js_unmap_file(&bundle->file);
+    free(bundle);
+    return -1;
+  }
+  bundle->next = opaque->bundles;
+  opaque->bundles = bundle;
+  return 0;
+}
+
+DLLEXPORT uint8_t *jsWriteBytecode(JSContext *ctx, JSValueConst *val, size_t *plen)
+{
+  return JS_WriteObject(ctx, plen, *val, JS_WRITE_OBJ_BYTECODE);
+}
+
+void js_free_bundles(JSBundle *bundle)
+{
+  while (bundle)
+  {
+    JSBundle *next = bundle->next;
+    js_unmap_file(&bundle->file);
+    free(bundle);
+    bundle = next;
+  }
+}
+
+/* returns undefined when no registered bundle has the module */
+JSValue js_bundle_load(JSContext *ctx, JSBundle *bundle, const char *module_name)
+{
+  size_t name_len = strlen(module_name);
+  for (; bundle; bundle = bundle->next)
+  {
+    uint32_t lo = 0, hi = bundle->count;
+    while (lo < hi)
+    {
+      uint32_t mid = lo + (hi - lo) / 2;
+      const JSBundleEntry *e = &bundle->entries[mid];
+      const char *name = (const char *)bundle->file.data + e->name_offset;
+      int cmp = memcmp(name, module_name, e->name_len < name_len ? e->name_len : name_len);
+      if (cmp == 0)
+        cmp = e->name_len < name_len ? -1 : e->name_len > name_len;
+      if (cmp == 0)
+      {
+        JSValue val = JS_ReadObject(ctx, bundle->file.data + e->data_offset, e->data_len, JS_READ_OBJ_BYTECODE);
+        if (!JS_IsException(val) && JS_VALUE_GET_TAG(val) != JS_TAG_MODULE)
+        {
+          JS_FreeValue(ctx, val);
+          val = JS_ThrowTypeError(ctx, "bundle entry '%s' is not a module", module_name);
+        }
+        return val;
+      }
+      if (cmp < 0)
+        lo = mid + 1;
+      else
+        hi = mid;
+    }
+  }
+  return JS_UNDEFINED;
+}
+
+/* export table of a native module; names are stored after the entries */
+typedef struct
+{
+  uint32_t count;
+  JSCFunctionListEntry list[1];
+} NativeModule;
+
+DLLEXPORT int32_t jsRegisterNativeModule(JSRuntime *rt, const char *module_name,
+                                         const JSNativeFunction *funcs, uint32_t count)
+{
+  RuntimeOpaque *opaque = (RuntimeOpaque *)JS_GetRuntimeOpaque(rt);
+  if (opaque == NULL || count == 0 || count > INT32_MAX / sizeof(JSCFunctionListEntry))
+    return -1;
+  /*
+   * JS_NewCModule registers the module before its exports are added, so
+   * anything JS_AddModuleExportList would reject (e.g. a duplicate name)
+   * is rejected here instead of leaving a half-built module behind.
+   */
+  size_t size = sizeof(NativeModule) + (count - 1) * sizeof(JSCFunctionListEntry);
+  StrMap seen;
+  memset(&seen, 0, sizeof(StrMap));
+  int ok = 1;
+  for (uint32_t i = 0; ok && i < count; i++)
+  {
+    ok = funcs[i].name != NULL && funcs[i].func != NULL && funcs[i].length >= 0 && funcs[i].length <= 255;
+    if (ok)
+    {
+      size_t name_len = strlen(funcs[i].name);
+      ok = strmap_find(&seen, funcs[i].name, name_len) == NULL &&
+           strmap_put(&seen, funcs[i].name, name_len, i) != NULL;
+      size += name_len + 1;
+    }
+  }
+  strmap_free(&seen);
+  if (!ok)
+    return -1;
+  NativeModule *nm = (NativeModule *)malloc(size);
+  if (nm == NULL)
+    return -1;
+  char *names = (char *)&nm->list[count];
+  nm->count = count;
+  for (uint32_t i = 0; i < count; i++)
+  {
+    JSCFunctionListEntry *e = &nm->list[i];
+    memset(e, 0, sizeof(JSCFunctionListEntry));
+    strcpy(names, funcs[i].name);
+    e->name = names;
+    e->prop_flags = JS_PROP_WRITABLE | JS_PROP_CONFIGURABLE;
+    e->def_type = JS_DEF_CFUNC;
+    e->u.func.length = (uint8_t)funcs[i].length;
+    e->u.func.cproto = JS_CFUNC_generic;
+    e->u.func.cfunc.generic = funcs[i].func;
+    names += strlen(names) + 1;
+  }
+  size_t name_len = strlen(module_name);
+  StrMapEntry *slot = strmap_find(&opaque->native_modules, module_name, name_len);
+  if (slot)
+  {
+    free((void *)(uintptr_t)slot->value);
+    slot->value = (uintptr_t)nm;
+    return 0;
+  }
+  if (strmap_put(&opaque->native_modules, module_name, name_len, (uintptr_t)nm) == NULL)
+  {
+    free(nm);
+    return -1;
+  }
+  return 0;
+}
+
+NativeModule *js_find_native_module(RuntimeOpaque *opaque, const char *module_name)
+{
+  StrMapEntry *slot = strmap_find(&opaque->native_modules, module_name, strlen(module_name));
+  return slot ? (NativeModule *)(uintptr_t)slot->value : NULL;
+}
+
+int js_native_module_init(JSContext *ctx, JSModuleDef *m)
+{
+  RuntimeOpaque *opaque = (RuntimeOpaque *)JS_GetRuntimeOpaque(JS_GetRuntime(ctx));
+  JSAtom name_atom = JS_GetModuleName(ctx, m);
+  const char *module_name = JS_AtomToCString(ctx, name_atom);
+  JS_FreeAtom(ctx, name_atom);
+  if (module_name == NULL)
+    return -1;
+  NativeModule *nm = opaque ? js_find_native_module(opaque, module_name) : NULL;
+  JS_FreeCString(ctx, module_name);
+  if (nm == NULL)
+  {
+    JS_ThrowReferenceError(ctx, "native module is no longer registered");
+    return -1;
+  }
+  return JS_SetModuleExportList(ctx, m, nm->list, (int)nm->count);
+}
+
+/*
+ * The export table was validated on registration, so only running out of
+ * memory fails here. quickjs cannot unregister the module, so later
+ * imports of the name in this context see it without its exports.
+ */
+JSModuleDef *js_native_module_load(JSContext *ctx, NativeModule *nm, const char *module_name)
+{
+  JSModuleDef *m = JS_NewCModule(ctx, module_name, js_native_module_init);
+  if (m == NULL)
+    return NULL;
+  if (JS_AddModuleExportList(ctx, m, nm->list, (int)nm->count) < 0)
+  {
+    JS_FreeValue(ctx, JS_GetException(ctx));
+    JS_ThrowInternalError(ctx, "cannot declare the exports of native module '%s'", module_name);
+    return NULL;
+  }
+  return m;
+}
+
+/* resolve `spec` against the directory of `base`, folding "." and ".." segments */
+char *js_resolve_module_name(JSContext *ctx, const char *base, const char *spec)
+{
+  const char *slash = strrchr(base, '/');
+  size_t dir_len = slash ? (size_t)(slash - base) + 1 : 0;
+  size_t spec_len = strlen(spec);
+  char *path = (char *)malloc(dir_len + spec_len + 1);
+  char *out = (char *)js_malloc(ctx, dir_len + spec_len + 1);
+  if (path == NULL || out == NULL)
+  {
+    free(path);
+    if (out)
+      js_free(ctx, out);
+    return NULL;
+  }
+  memcpy(path, base, dir_len);
+  memcpy(path + dir_len, spec, spec_len + 1);
+
+  /* an empty `out` with segments left is the leading empty segment of an absolute path */
+  size_t out_len = 0;
+  uint32_t segments = 0;
+  for (const char *seg = path;;)
+  {
+    const char *end = strchr(seg, '/');
+    size_t len = end ? (size_t)(end - seg) : strlen(seg);
+    if (len == 1 && seg[0] == '.')
+    {
+      /* skip */
+    }
+    else if (len == 2 && seg[0] == '.' && seg[1] == '.' && segments > 0)
+    {
+      size_t prev = out_len;
+      while (prev > 0 && out[prev - 1] != '/')
+        prev--;
+      size_t prev_len = out_len - prev;
+      if (prev_len == 2 && out[prev] == '.' && out[prev + 1] == '.')
+      {
+        out[out_len++] = '/';
+        memcpy(out + out_len, seg, len);
+        out_len += len;
+        segments++;
+      }
+      else if (prev_len > 0)
+      {
+        /* pop the last segment; the root and empty segments stay */
+        out_len = prev > 0 ? prev - 1 : 0;
+        segments--;
+      }
+    }
+    else
+    {
+      if (segments > 0)
+        out[out_len++] = '/';
+      memcpy(out + out_len, seg, len);
+      out_len += len;
+      segments++;
+    }
+    if (end == NULL)
+      break;
+    seg = end + 1;
+  }
+  out[out_len] = '\0';
+  free(path);
+  return out;
+}
+
+/*
+ * Bare specifiers pass through like the default normalizer; relative ones
+ * are canonicalized once per (base, specifier) so every spelling of a path
+ * maps to the same module.
+ */
+char *__my_js_module_normalize(JSContext *ctx, const char *module_base_name, const char *module_name, void *opaque)
+{
+  if (module_name[0] != '.')
+    return js_strdup(ctx, module_name);
+  RuntimeOpaque *op = (RuntimeOpaque *)opaque;
+  size_t base_len = strlen(module_base_name);
+  size_t name_len = strlen(module_name);
+  char *key = (char *)malloc(base_len + 1 + name_len);
+  if (key == NULL)
+    return js_resolve_module_name(ctx, module_base_name, module_name);
+  memcpy(key, module_base_name, base_len + 1);
+  memcpy(key + base_len + 1, module_name, name_len);
+  StrMapEntry *slot = strmap_find(&op->module_names, key, base_len + 1 + name_len);
+  if (slot)
+  {
+    free(key);
+    return js_strdup(ctx, (const char *)(uintptr_t)slot->value);
+  }
+  char *resolved = js_resolve_module_name(ctx, module_base_name, module_name);
+  if (resolved)
+  {
+    char *copy = (char *)malloc(strlen(resolved) + 1);
+    if (copy)
+    {
+      strcpy(copy, resolved);
+      if (strmap_put(&op->module_names, key, base_len + 1 + name_len, (uintptr_t)copy) == NULL)
+        free(copy);
+    }
+  }
+  free(key);
+  return resolved;
+}
+
 JSModuleDef *__my_js_module_loader(
     JSContext *ctx,
     const char *module_name, void *opaque)
 {
-  const char *str = (char *)((RuntimeOpaque *)opaque)->channel(ctx, JSChannelType_MODULE, (void *)module_name);
-  if (str == 0)
-    return NULL;
-  JSValue func_val = JS_Eval(ctx, str, strlen(str), module_name, JS_EVAL_TYPE_MODULE | JS_EVAL_FLAG_COMPILE_ONLY);
+  NativeModule *nm = js_find_native_module((RuntimeOpaque *)opaque, module_name);
+  if (nm)
+    return js_native_module_load(ctx, nm, module_name);
+  JSValue func_val = js_bundle_load(ctx, ((RuntimeOpaque *)opaque)->bundles, module_name);
+  if (JS_IsUndefined(func_val))
+  {
+    const char *str = (char *)((RuntimeOpaque *)opaque)->channel(ctx, JSChannelType_MODULE, (void *)module_name);
+    if (str == 0)
+      return NULL;
+    func_val = js_compile_module(ctx, module_name, str, strlen(str));
+  }
   if (JS_IsException(func_val))
     return NULL;
   /* the module is already referenced, so we must free it */
@@ -87,19 +1061,211 @@ JSValue js_channel(JSContext *ctx, JSValueConst this_val, int argc, JSValueConst
   return *(JSValue *)opaque->channel(ctx, JSChannelType_METHON, data);
 }
 
-void js_promise_rejection_tracker(JSContext *ctx, JSValueConst promise,
-                                  JSValueConst reason,
-                                  JS_BOOL is_handled, void *opaque)
+/* magic is only 16 bits wide, so the id rides in an int slot of func_data */
+JSValue js_channel_id(JSContext *ctx, JSValueConst this_val, int argc, JSValueConst *argv, int magic, JSValue *func_data)
+{
+  JSRuntime *rt = JS_GetRuntime(ctx);
+  RuntimeOpaque *opaque = (RuntimeOpaque *)JS_GetRuntimeOpaque(rt);
+  uint32_t id = (uint32_t)JS_VALUE_GET_INT(func_data[0]);
+  void *data[4];
+  data[0] = &this_val;
+  data[1] = &argc;
+  data[2] = argv;
+  data[3] = &id;
+  return *(JSValue *)opaque->channel(ctx, JSChannelType_METHOD_ID, data);
+}
+
+/*
+ * Compacts when the end is reached and grows when full, since events keep
+ * arriving until the next safe point delivers them. Reaching high water
+ * only marks the queue, as this runs inside GC. Returns -1 when out of memory.
+ */
+int js_notify_push(NotifyQueue *q, void *ptr, JSValue value)
+{
+  if (q->end == q->capacity)
+  {
+    uint32_t count = q->end - q->start;
+    if (q->start == 0)
+    {
+      if (q->capacity > UINT32_MAX / 2 / (sizeof(void *) + sizeof(JSValue)))
+        return -1;
+      uint32_t capacity = q->capacity * 2;
+      void **ptrs = (void **)realloc(q->ptrs, capacity * sizeof(void *));
+      if (ptrs == NULL)
+        return -1;
+      q->ptrs = ptrs;
+      if (q->values)
+      {
+        JSValue *values = (JSValue *)realloc(q->values, capacity * sizeof(JSValue));
+        if (values == NULL)
+          return -1;
+        q->values = values;
+      }
+      q->capacity = capacity;
+    }
+    else
+    {
+      memmove(q->ptrs, q->ptrs + q->start, count * sizeof(void *));
+      if (q->values)
+        memmove(q->values, q->values + q->start, count * sizeof(JSValue));
+      q->start = 0;
+      q->end = count;
+    }
+  }
+  q->ptrs[q->end] = ptr;
+  if (q->values)
+    q->values[q->end] = value;
+  q->end++;
+  if (q->end - q->start >= q->high_water)
+    q->pending = 1;
+  return 0;
+}
+
+/*
+ * The pending events are moved out before calling the host, which may
+ * run code that queues more of them.
+ */
+void js_flush_finalizers(JSRuntime *rt, RuntimeOpaque *opaque)
+{
+  NotifyQueue *q = &opaque->finalizers;
+  uint32_t count = q->end - q->start;
+  q->pending = 0;
+  if (count == 0)
+    return;
+  void **ptrs = (void **)malloc(count * sizeof(void *));
+  if (ptrs == NULL)
+  {
+    while (q->start < q->end)
+      opaque->channel((JSContext *)rt, JSChannelType_FREE_OBJECT, q->ptrs[q->start++]);
+    q->start = q->end = 0;
+    return;
+  }
+  memcpy(ptrs, q->ptrs + q->start, count * sizeof(void *));
+  q->start = q->end = 0;
+  void *data[2];
+  data[0] = &count;
+  data[1] = ptrs;
+  opaque->channel((JSContext *)rt, JSChannelType_FREE_OBJECT_BATCH, data);
+  free(ptrs);
+}
+
+void js_flush_rejections(JSRuntime *rt, RuntimeOpaque *opaque)
+{
+  NotifyQueue *q = &opaque->rejections;
+  uint32_t count = q->end - q->start;
+  q->pending = 0;
+  if (count == 0)
+    return;
+  void **ctxs = (void **)malloc(count * (sizeof(void *) + sizeof(JSValue)));
+  if (ctxs == NULL)
+  {
+    while (q->start < q->end)
+    {
+      JSContext *ctx = (JSContext *)q->ptrs[q->start];
+      JSValue reason = q->values[q->start++];
+      opaque->channel(ctx, JSChannelType_PROMISE_TRACK, &reason);
+      JS_FreeValueRT(rt, reason);
+    }
+    q->start = q->end = 0;
+    return;
+  }
+  JSValue *reasons = (JSValue *)(ctxs + count);
+  memcpy(ctxs, q->ptrs + q->start, count * sizeof(void *));
+  memcpy(reasons, q->values + q->start, count * sizeof(JSValue));
+  q->start = q->end = 0;
+  void *data[3];
+  data[0] = &count;
+  data[1] = ctxs;
+  data[2] = reasons;
+  opaque->channel((JSContext *)rt, JSChannelType_PROMISE_TRACK_BATCH, data);
+  for (uint32_t i = 0; i < count; i++)
+    JS_FreeValueRT(rt, reasons[i]);
+  free(ctxs);
+}
+
+void js_promise_rejection_tracker(JSContext *ctx, JSValueConst promise,
+                                  JSValueConst reason,
+                                  JS_BOOL is_handled, void *opaque)
+{
+  if (is_handled)
+    return;
+  RuntimeOpaque *op = (RuntimeOpaque *)opaque;
+  NotifyQueue *q = &op->rejections;
+  JSValue value = JS_DupValue(ctx, reason);
+  if (q->capacity == 0 || js_notify_push(q, ctx, value))
+  {
+    op->channel(ctx, JSChannelType_PROMISE_TRACK, &reason);
+    JS_FreeValue(ctx, value);
+  }
+}
+
+#ifdef CLOCK_MONOTONIC_COARSE
+#define JS_DEADLINE_MONOTONIC CLOCK_MONOTONIC_COARSE
+#else
+#define JS_DEADLINE_MONOTONIC CLOCK_MONOTONIC
+#endif
+
+int64_t js_clock_ns(int32_t kind)
+{
+#ifdef _WIN32
+  if (kind == JSDeadlineClock_MONOTONIC)
+    return (int64_t)GetTickCount64() * 1000000;
+  if (kind == JSDeadlineClock_THREAD_CPU)
+  {
+    FILETIME creation, exited, kernel, user;
+    GetThreadTimes(GetCurrentThread(), &creation, &exited, &kernel, &user);
+    uint64_t k = ((uint64_t)kernel.dwHighDateTime << 32) | kernel.dwLowDateTime;
+    uint64_t u = ((uint64_t)user.dwHighDateTime << 32) | user.dwLowDateTime;
+    return (int64_t)(k + u) * 100;
+  }
+#else
+  struct timespec ts;
+  if (kind == JSDeadlineClock_MONOTONIC || kind == JSDeadlineClock_THREAD_CPU)
+  {
+    clock_gettime(kind == JSDeadlineClock_MONOTONIC ? JS_DEADLINE_MONOTONIC : CLOCK_THREAD_CPUTIME_ID, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+  }
+#endif
+  return (int64_t)clock() * (1000000000 / CLOCKS_PER_SEC);
+}
+
+/* precise monotonic clock for job budgets */
+int64_t js_monotonic_ns()
 {
-  if (is_handled)
-    return;
-  ((RuntimeOpaque *)opaque)->channel(ctx, JSChannelType_PROMISE_TRACK, &reason);
-}
+#ifdef _WIN32
+  LARGE_INTEGER freq, now;
+  QueryPerformanceFrequency(&freq);
+  QueryPerformanceCounter(&now);
+  return (int64_t)((double)now.QuadPart * 1e9 / (double)freq.QuadPart);
+#else
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+#endif
+}
+
+#ifdef _MSC_VER
+#define js_atomic_load(p) (*(p))
+#define js_atomic_exchange(p, v) InterlockedExchange((volatile LONG *)(p), (v))
+#else
+#define js_atomic_load(p) __atomic_load_n((p), __ATOMIC_RELAXED)
+#define js_atomic_exchange(p, v) __atomic_exchange_n((p), (v), __ATOMIC_ACQ_REL)
+#endif
 
 int js_interrupt_handler(JSRuntime *rt, void *opaque)
 {
   RuntimeOpaque *op = (RuntimeOpaque *)opaque;
-  if (op->timeout && op->start && (clock() - op->start) > op->timeout * CLOCKS_PER_SEC / 1000)
+  if (js_atomic_load(&op->interrupt_requested) && js_atomic_exchange(&op->interrupt_requested, 0))
+    return 1;
+  if (!op->timeout || !op->start)
+    return 0;
+  if (op->check_countdown > 1)
+  {
+    op->check_countdown--;
+    return 0;
+  }
+  op->check_countdown = op->check_stride;
+  if (js_clock_ns(op->deadline_clock) - op->start > op->timeout * 1000000)
   {
     op->start = 0;
     return 1;
@@ -113,7 +1279,7 @@ DLLEXPORT JSRuntime *jsNewRuntime(JSChannel channel, int64_t timeout)
   RuntimeOpaque *opaque = _CPP_NEW_RT(channel, timeout, 0);
   JS_SetRuntimeOpaque(rt, opaque);
   JS_SetHostPromiseRejectionTracker(rt, js_promise_rejection_tracker, opaque);
-  JS_SetModuleLoaderFunc(rt, NULL, __my_js_module_loader, opaque);
+  JS_SetModuleLoaderFunc(rt, __my_js_module_normalize, __my_js_module_loader, opaque);
   JS_SetInterruptHandler(rt, js_interrupt_handler, opaque);
   return rt;
 }
@@ -125,19 +1291,95 @@ void jsNewClass_finalizer(JSRuntime *rt, JSValue obj)
     RuntimeOpaque *runtimeOpaque = (RuntimeOpaque *)JS_GetRuntimeOpaque(rt);
     if (runtimeOpaque == NULL)
       return;
-    runtimeOpaque->channel((JSContext *)rt, JSChannelType_FREE_OBJECT, opaque);
+    NotifyQueue *q = &runtimeOpaque->finalizers;
+    if (q->capacity == 0 || js_notify_push(q, opaque, JS_UNDEFINED))
+      runtimeOpaque->channel((JSContext *)rt, JSChannelType_FREE_OBJECT, opaque);
   }
 
-DLLEXPORT uint32_t jsNewClass(JSContext *ctx, const char *name)
+/* class ids are process-wide in quickjs, so each class name gets one id shared by every runtime */
+typedef struct
+{
+  JSMutex lock;
+  StrMap ids;
+} ClassRegistry;
+
+ClassRegistry js_class_registry = {JS_MUTEX_INIT};
+
+/*
+ * The hooks are part of the key, so asking for a name with other hooks
+ * gets a distinct class rather than silently reusing the first one.
+ */
+JSClassID js_class_id_for_name(const char *name, JSClassGCMark *gc_mark, const JSClassExoticMethods *exotic)
+{
+  ClassRegistry *reg = &js_class_registry;
+  size_t name_len = strlen(name);
+  size_t key_len = name_len + 2 + sizeof(gc_mark) + sizeof(JSClassExoticMethods);
+  char *key = (char *)malloc(key_len);
+  if (key == NULL)
+    return 0;
+  memcpy(key, name, name_len + 1);
+  memcpy(key + name_len + 1, &gc_mark, sizeof(gc_mark));
+  key[name_len + 1 + sizeof(gc_mark)] = exotic != NULL;
+  if (exotic)
+    memcpy(key + name_len + 2 + sizeof(gc_mark), exotic, sizeof(JSClassExoticMethods));
+  else
+    memset(key + name_len + 2 + sizeof(gc_mark), 0, sizeof(JSClassExoticMethods));
+  JSClassID class_id = 0;
+  js_mutex_lock(&reg->lock);
+  StrMapEntry *slot = strmap_find(&reg->ids, key, key_len);
+  if (slot)
+  {
+    class_id = (JSClassID)slot->value;
+  }
+  else
+  {
+    if (JS_NewClassID(&class_id))
+      strmap_put(&reg->ids, key, key_len, class_id);
+  }
+  js_mutex_unlock(&reg->lock);
+  free(key);
+  return class_id;
+}
+
+/* exotic methods are referenced by the class until the runtime is gone */
+typedef struct ClassExotic
+{
+  struct ClassExotic *next;
+  JSClassExoticMethods methods;
+} ClassExotic;
+
+DLLEXPORT uint32_t jsNewClassEx(JSContext *ctx, const char *name, JSClassGCMark *gc_mark,
+                                const JSClassExoticMethods *exotic)
 {
-  JSClassID QJSClassId = 0;
-  JS_NewClassID(&QJSClassId);
+  JSClassID QJSClassId = js_class_id_for_name(name, gc_mark, exotic);
+  if (QJSClassId == 0)
+  {
+    JS_ThrowInternalError(ctx, "Cant register class %s", name);
+    return 0;
+  }
   JSRuntime *rt = JS_GetRuntime(ctx);
   if (!JS_IsRegisteredClass(rt, QJSClassId))
   {
     JSClassDef def;
+    memset(&def, 0, sizeof(JSClassDef));
     def.class_name = name;
     def.finalizer = jsNewClass_finalizer;
+    def.gc_mark = gc_mark;
+    if (exotic)
+    {
+      RuntimeOpaque *opaque = (RuntimeOpaque *)JS_GetRuntimeOpaque(rt);
+      ClassExotic *ce = (ClassExotic *)malloc(sizeof(ClassExotic));
+      if (opaque == NULL || ce == NULL)
+      {
+        free(ce);
+        JS_ThrowOutOfMemory(ctx);
+        return 0;
+      }
+      ce->methods = *exotic;
+      ce->next = opaque->class_exotics;
+      opaque->class_exotics = ce;
+      def.exotic = &ce->methods;
+    }
 
     int e = JS_NewClass(rt, QJSClassId, &def);
     if (e < 0)
@@ -149,6 +1391,82 @@ DLLEXPORT uint32_t jsNewClass(JSContext *ctx, const char *name)
   return QJSClassId;
 }
 
+DLLEXPORT uint32_t jsNewClass(JSContext *ctx, const char *name)
+{
+  return jsNewClassEx(ctx, name, NULL, NULL);
+}
+
+int js_host_exotic_request(JSContext *ctx, JSValueConst obj, JSExoticRequest *req)
+{
+  RuntimeOpaque *opaque = (RuntimeOpaque *)JS_GetRuntimeOpaque(JS_GetRuntime(ctx));
+  req->opaque = JS_GetOpaque(obj, JS_GetClassID(obj));
+  req->found = 0;
+  req->value = JS_UNDEFINED;
+  req->keys = NULL;
+  req->key_count = 0;
+  if (opaque)
+    opaque->channel(ctx, JSChannelType_EXOTIC, req);
+  return req->found;
+}
+
+/* a NULL `desc` is an existence check, e.g. from the `in` operator */
+int js_host_get_own_property(JSContext *ctx, JSPropertyDescriptor *desc, JSValueConst obj, JSAtom prop)
+{
+  JSExoticRequest req;
+  req.op = desc ? JSExoticOp_GET : JSExoticOp_HAS;
+  req.atom = prop;
+  int found = js_host_exotic_request(ctx, obj, &req);
+  if (found <= 0 || desc == NULL)
+  {
+    JS_FreeValue(ctx, req.value);
+    return found < 0 ? -1 : found > 0;
+  }
+  if (JS_IsException(req.value))
+    return -1;
+  desc->flags = JS_PROP_ENUMERABLE;
+  desc->value = req.value;
+  desc->getter = JS_UNDEFINED;
+  desc->setter = JS_UNDEFINED;
+  return 1;
+}
+
+int js_host_get_own_property_names(JSContext *ctx, JSPropertyEnum **ptab, uint32_t *plen, JSValueConst obj)
+{
+  JSExoticRequest req;
+  req.op = JSExoticOp_KEYS;
+  req.atom = JS_ATOM_NULL;
+  int found = js_host_exotic_request(ctx, obj, &req);
+  uint32_t n = req.keys ? req.key_count : 0;
+  JSPropertyEnum *tab = found < 0 ? NULL : (JSPropertyEnum *)js_malloc(ctx, sizeof(JSPropertyEnum) * (n ? n : 1));
+  for (uint32_t i = 0; tab && i < n; i++)
+  {
+    tab[i].is_enumerable = 1;
+    tab[i].atom = JS_DupAtom(ctx, req.keys[i]);
+  }
+  if (req.keys)
+    js_free(ctx, req.keys);
+  if (tab == NULL)
+    return -1;
+  *ptab = tab;
+  *plen = n;
+  return 0;
+}
+
+JSClassExoticMethods js_host_exotic_methods = {
+    js_host_get_own_property,
+    js_host_get_own_property_names,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+};
+
+DLLEXPORT uint32_t jsNewClassExotic(JSContext *ctx, const char *name)
+{
+  return jsNewClassEx(ctx, name, NULL, &js_host_exotic_methods);
+}
+
 DLLEXPORT void *jsGetObjectOpaque(JSValue *obj, uint32_t classid)
 {
   return JS_GetOpaque(*obj, classid);
@@ -163,6 +1481,197 @@ DLLEXPORT JSValue *jsNewObjectClass(JSContext *ctx, uint32_t QJSClassId, void *o
   return jsobj;
 }
 
+/* deliver until both queues stay empty, as the host may queue more while handling a batch */
+void js_flush_notifications(JSRuntime *rt, RuntimeOpaque *opaque)
+{
+  while (opaque->finalizers.end > opaque->finalizers.start || opaque->rejections.end > opaque->rejections.start)
+  {
+    js_flush_finalizers(rt, opaque);
+    js_flush_rejections(rt, opaque);
+  }
+}
+
+int js_notify_queue_init(JSRuntime *rt, NotifyQueue *q, uint32_t capacity, uint32_t high_water, int with_values)
+{
+  if (q->values)
+    for (uint32_t i = q->start; i < q->end; i++)
+      JS_FreeValueRT(rt, q->values[i]);
+  free(q->ptrs);
+  free(q->values);
+  memset(q, 0, sizeof(NotifyQueue));
+  if (capacity == 0)
+    return 0;
+  q->ptrs = (void **)malloc(capacity * sizeof(void *));
+  q->values = with_values ? (JSValue *)malloc(capacity * sizeof(JSValue)) : NULL;
+  if (q->ptrs == NULL || (with_values && q->values == NULL))
+  {
+    free(q->ptrs);
+    free(q->values);
+    q->ptrs = NULL;
+    q->values = NULL;
+    return -1;
+  }
+  q->capacity = capacity;
+  q->high_water = high_water && high_water < capacity ? high_water : capacity;
+  return 0;
+}
+
+DLLEXPORT int32_t jsSetNotificationBatching(JSRuntime *rt, uint32_t capacity, uint32_t high_water)
+{
+  RuntimeOpaque *opaque = (RuntimeOpaque *)JS_GetRuntimeOpaque(rt);
+  if (opaque == NULL || capacity > UINT32_MAX / (sizeof(void *) + sizeof(JSValue)))
+    return -1;
+  js_flush_notifications(rt, opaque);
+  if (js_notify_queue_init(rt, &opaque->finalizers, capacity, high_water, 0) ||
+      js_notify_queue_init(rt, &opaque->rejections, capacity, high_water, 1))
+  {
+    js_notify_queue_init(rt, &opaque->finalizers, 0, 0, 0);
+    return -1;
+  }
+  return 0;
+}
+
+DLLEXPORT uint32_t jsDrainFinalizers(JSRuntime *rt, void **out, uint32_t n)
+{
+  RuntimeOpaque *opaque = (RuntimeOpaque *)JS_GetRuntimeOpaque(rt);
+  if (opaque == NULL)
+    return 0;
+  NotifyQueue *q = &opaque->finalizers;
+  uint32_t count = q->end - q->start;
+  if (count > n)
+    count = n;
+  if (count)
+    memcpy(out, q->ptrs + q->start, count * sizeof(void *));
+  q->start += count;
+  if (q->start == q->end)
+    q->start = q->end = 0;
+  if (q->end - q->start < q->high_water)
+    q->pending = 0;
+  return count;
+}
+
+DLLEXPORT uint32_t jsDrainRejections(JSRuntime *rt, JSValue *reasons, JSContext **ctxs, uint32_t n)
+{
+  RuntimeOpaque *opaque = (RuntimeOpaque *)JS_GetRuntimeOpaque(rt);
+  if (opaque == NULL)
+    return 0;
+  NotifyQueue *q = &opaque->rejections;
+  uint32_t count = q->end - q->start;
+  if (count > n)
+    count = n;
+  for (uint32_t i = 0; i < count; i++)
+  {
+    ctxs[i] = (JSContext *)q->ptrs[q->start + i];
+    reasons[i] = q->values[q->start + i];
+  }
+  q->start += count;
+  if (q->start == q->end)
+    q->start = q->end = 0;
+  if (q->end - q->start < q->high_water)
+    q->pending = 0;
+  return count;
+}
+
+DLLEXPORT void jsSetDeadlineMode(JSRuntime *rt, int32_t deadline_clock, uint32_t check_stride)
+{
+  RuntimeOpaque *opaque = (RuntimeOpaque *)JS_GetRuntimeOpaque(rt);
+  if (opaque == NULL)
+    return;
+  opaque->deadline_clock = deadline_clock;
+  opaque->check_stride = check_stride ? check_stride : 1;
+  opaque->check_countdown = 0;
+}
+
+DLLEXPORT void jsRequestInterrupt(JSRuntime *rt)
+{
+  RuntimeOpaque *opaque = (RuntimeOpaque *)JS_GetRuntimeOpaque(rt);
+  if (opaque)
+    js_atomic_exchange(&opaque->interrupt_requested, 1);
+}
+
+DLLEXPORT void jsClearInterrupt(JSRuntime *rt)
+{
+  RuntimeOpaque *opaque = (RuntimeOpaque *)JS_GetRuntimeOpaque(rt);
+  if (opaque)
+    js_atomic_exchange(&opaque->interrupt_requested, 0);
+}
+
+/*
+ * Per-runtime LRU of compiled global scripts, keyed by the exact context,
+ * flags, filename and source so a hit never runs different code.
+ */
+typedef struct EvalCacheEntry
+{
+  struct EvalCacheEntry *prev;
+  struct EvalCacheEntry *next;
+  const char *key;
+  size_t key_len;
+  JSContext *ctx;
+  JSValue func;
+} EvalCacheEntry;
+
+void js_eval_cache_unlink(RuntimeOpaque *opaque, EvalCacheEntry *e)
+{
+  if (e->prev)
+    e->prev->next = e->next;
+  else
+    opaque->eval_head = e->next;
+  if (e->next)
+    e->next->prev = e->prev;
+  else
+    opaque->eval_tail = e->prev;
+  e->prev = e->next = NULL;
+}
+
+void js_eval_cache_push(RuntimeOpaque *opaque, EvalCacheEntry *e)
+{
+  e->next = opaque->eval_head;
+  if (opaque->eval_head)
+    opaque->eval_head->prev = e;
+  opaque->eval_head = e;
+  if (opaque->eval_tail == NULL)
+    opaque->eval_tail = e;
+}
+
+void js_eval_cache_drop(JSRuntime *rt, RuntimeOpaque *opaque, EvalCacheEntry *e)
+{
+  js_eval_cache_unlink(opaque, e);
+  strmap_del(&opaque->eval_index, strmap_find(&opaque->eval_index, e->key, e->key_len));
+  JS_FreeValueRT(rt, e->func);
+  free(e);
+  opaque->eval_count--;
+}
+
+void js_eval_cache_trim(JSRuntime *rt, RuntimeOpaque *opaque, uint32_t capacity)
+{
+  while (opaque->eval_tail && opaque->eval_count > capacity)
+    js_eval_cache_drop(rt, opaque, opaque->eval_tail);
+}
+
+/* compiled scripts keep their realm alive, so entries must go before the context */
+void js_eval_cache_purge(JSRuntime *rt, RuntimeOpaque *opaque, JSContext *ctx)
+{
+  EvalCacheEntry *e = opaque->eval_head;
+  while (e)
+  {
+    EvalCacheEntry *next = e->next;
+    if (ctx == NULL || e->ctx == ctx)
+      js_eval_cache_drop(rt, opaque, e);
+    e = next;
+  }
+}
+
+DLLEXPORT void jsSetEvalCacheCapacity(JSRuntime *rt, uint32_t capacity)
+{
+  RuntimeOpaque *opaque = (RuntimeOpaque *)JS_GetRuntimeOpaque(rt);
+  if (opaque == NULL)
+    return;
+  opaque->eval_capacity = capacity;
+  js_eval_cache_trim(rt, opaque, capacity);
+  if (capacity == 0)
+    strmap_free(&opaque->eval_index);
+}
+
 DLLEXPORT void jsSetMaxStackSize(JSRuntime *rt, size_t stack_size)
 {
   JS_SetMaxStackSize(rt, stack_size);
@@ -176,10 +1685,37 @@ DLLEXPORT void jsSetMemoryLimit(JSRuntime *rt, size_t limit)
 DLLEXPORT void jsFreeRuntime(JSRuntime *rt)
 {
   RuntimeOpaque *opauqe = (RuntimeOpaque *)JS_GetRuntimeOpaque(rt);
+  ClassExotic *exotics = opauqe ? opauqe->class_exotics : NULL;
   if (opauqe)
+  {
+    js_flush_notifications(rt, opauqe);
+    js_notify_queue_init(rt, &opauqe->finalizers, 0, 0, 0);
+    js_notify_queue_init(rt, &opauqe->rejections, 0, 0, 1);
+    for (uint32_t i = 0; i < opauqe->atoms.cap; i++)
+      if (opauqe->atoms.entries[i].key)
+        JS_FreeAtomRT(rt, (JSAtom)opauqe->atoms.entries[i].value);
+    strmap_free(&opauqe->atoms);
+    for (uint32_t i = 0; i < opauqe->module_names.cap; i++)
+      if (opauqe->module_names.entries[i].key)
+        free((void *)(uintptr_t)opauqe->module_names.entries[i].value);
+    strmap_free(&opauqe->module_names);
+    for (uint32_t i = 0; i < opauqe->native_modules.cap; i++)
+      if (opauqe->native_modules.entries[i].key)
+        free((void *)(uintptr_t)opauqe->native_modules.entries[i].value);
+    strmap_free(&opauqe->native_modules);
+    js_free_bundles(opauqe->bundles);
+    js_eval_cache_purge(rt, opauqe, NULL);
+    strmap_free(&opauqe->eval_index);
     _CPP_DELETE_RT(opauqe);
+  }
   JS_SetRuntimeOpaque(rt, NULL);
   JS_FreeRuntime(rt);
+  while (exotics)
+  {
+    ClassExotic *next = exotics->next;
+    free(exotics);
+    exotics = next;
+  }
 }
 
 DLLEXPORT JSValue *jsNewCFunction(JSContext *ctx, JSValue *funcData)
@@ -187,15 +1723,49 @@ DLLEXPORT JSValue *jsNewCFunction(JSContext *ctx, JSValue *funcData)
   return _CPP_NEW_JSVALUE(JS_NewCFunctionData(ctx, js_channel, 0, 0, 1, funcData));
 }
 
+DLLEXPORT JSValue *jsNewCFunctionId(JSContext *ctx, uint32_t id, int32_t argc)
+{
+  JSValue data = JS_NewInt32(ctx, (int32_t)id);
+  return _CPP_NEW_JSVALUE(JS_NewCFunctionData(ctx, js_channel_id, argc, 0, 1, &data));
+}
+
 DLLEXPORT JSContext *jsNewContext(JSRuntime *rt)
 {
   JS_UpdateStackTop(rt);
   JSContext *ctx = JS_NewContext(rt);
+  if (ctx == NULL)
+    return NULL;
+  ContextOpaque *opaque = (ContextOpaque *)malloc(sizeof(ContextOpaque));
+  if (opaque)
+  {
+    JSValue global = JS_GetGlobalObject(ctx);
+    for (int32_t i = 0; i < JSTypedArrayType_COUNT; i++)
+      opaque->typed_array_ctors[i] = JS_GetPropertyStr(ctx, global, js_builtin_class_ctors[i]);
+    JS_FreeValue(ctx, global);
+    JS_SetContextOpaque(ctx, opaque);
+  }
   return ctx;
 }
 
 DLLEXPORT void jsFreeContext(JSContext *ctx)
 {
+  JSRuntime *rt = JS_GetRuntime(ctx);
+  RuntimeOpaque *opaque = (RuntimeOpaque *)JS_GetRuntimeOpaque(rt);
+  if (opaque)
+  {
+    /* queued rejections must not outlive their context */
+    while (opaque->rejections.end > opaque->rejections.start)
+      js_flush_rejections(rt, opaque);
+    js_eval_cache_purge(rt, opaque, ctx);
+  }
+  ContextOpaque *ctx_opaque = (ContextOpaque *)JS_GetContextOpaque(ctx);
+  if (ctx_opaque)
+  {
+    for (int32_t i = 0; i < JSTypedArrayType_COUNT; i++)
+      JS_FreeValue(ctx, ctx_opaque->typed_array_ctors[i]);
+    free(ctx_opaque);
+    JS_SetContextOpaque(ctx, NULL);
+  }
   JS_FreeContext(ctx);
 }
 
@@ -208,16 +1778,126 @@ void js_begin_call(JSRuntime *rt)
 {
   JS_UpdateStackTop(rt);
   RuntimeOpaque *opaque = (RuntimeOpaque *)JS_GetRuntimeOpaque(rt);
-  if (opaque)
-    opaque->start = clock();
+  if (opaque && opaque->timeout)
+    opaque->start = js_clock_ns(opaque->deadline_clock);
+}
+
+/* safe point after running script: deliver notification batches that reached high water */
+JSValue js_end_call(JSRuntime *rt, JSValue ret)
+{
+  RuntimeOpaque *opaque = (RuntimeOpaque *)JS_GetRuntimeOpaque(rt);
+  if (opaque && opaque->finalizers.pending)
+    js_flush_finalizers(rt, opaque);
+  if (opaque && opaque->rejections.pending)
+    js_flush_rejections(rt, opaque);
+  return ret;
+}
+
+/* compile without running; global scripts go through the eval cache when it is enabled */
+JSValue js_compile(JSContext *ctx, const char *input, size_t input_len, const char *filename, int32_t eval_flags)
+{
+  JSRuntime *rt = JS_GetRuntime(ctx);
+  RuntimeOpaque *opaque = (RuntimeOpaque *)JS_GetRuntimeOpaque(rt);
+  eval_flags |= JS_EVAL_FLAG_COMPILE_ONLY;
+  /* modules register themselves by name, so only global scripts can be reused */
+  if (opaque == NULL || opaque->eval_capacity == 0 || (eval_flags & JS_EVAL_TYPE_MASK) != JS_EVAL_TYPE_GLOBAL)
+    return JS_Eval(ctx, input, input_len, filename, eval_flags);
+
+  size_t name_len = strlen(filename) + 1;
+  size_t key_len = sizeof(ctx) + sizeof(eval_flags) + name_len + input_len;
+  char *key = (char *)malloc(key_len);
+  if (key == NULL)
+    return JS_Eval(ctx, input, input_len, filename, eval_flags);
+  memcpy(key, &ctx, sizeof(ctx));
+  memcpy(key + sizeof(ctx), &eval_flags, sizeof(eval_flags));
+  memcpy(key + sizeof(ctx) + sizeof(eval_flags), filename, name_len);
+  memcpy(key + sizeof(ctx) + sizeof(eval_flags) + name_len, input, input_len);
+
+  StrMapEntry *slot = strmap_find(&opaque->eval_index, key, key_len);
+  if (slot)
+  {
+    free(key);
+    EvalCacheEntry *e = (EvalCacheEntry *)(uintptr_t)slot->value;
+    js_eval_cache_unlink(opaque, e);
+    js_eval_cache_push(opaque, e);
+    return JS_DupValue(ctx, e->func);
+  }
+  JSValue func = JS_Eval(ctx, input, input_len, filename, eval_flags);
+  EvalCacheEntry *e = JS_IsException(func) ? NULL : (EvalCacheEntry *)malloc(sizeof(EvalCacheEntry));
+  if (e)
+  {
+    slot = strmap_put(&opaque->eval_index, key, key_len, (uintptr_t)e);
+    if (slot == NULL)
+    {
+      free(e);
+    }
+    else
+    {
+      e->key = slot->key;
+      e->key_len = key_len;
+      e->ctx = ctx;
+      e->func = JS_DupValue(ctx, func);
+      e->prev = NULL;
+      js_eval_cache_push(opaque, e);
+      opaque->eval_count++;
+      js_eval_cache_trim(rt, opaque, opaque->eval_capacity);
+    }
+  }
+  free(key);
+  return func;
 }
 
 DLLEXPORT JSValue *jsEval(JSContext *ctx, const char *input, size_t input_len, const char *filename, int32_t eval_flags)
 {
   JSRuntime *rt = JS_GetRuntime(ctx);
   js_begin_call(rt);
-  JSValue *ret = _CPP_NEW_JSVALUE(JS_Eval(ctx, input, input_len, filename, eval_flags));
-  return ret;
+  if (eval_flags & JS_EVAL_FLAG_COMPILE_ONLY)
+    return _CPP_NEW_JSVALUE(js_compile(ctx, input, input_len, filename, eval_flags));
+  RuntimeOpaque *opaque = (RuntimeOpaque *)JS_GetRuntimeOpaque(rt);
+  if (opaque == NULL || opaque->eval_capacity == 0 || (eval_flags & JS_EVAL_TYPE_MASK) != JS_EVAL_TYPE_GLOBAL)
+    return _CPP_NEW_JSVALUE(js_end_call(rt, JS_Eval(ctx, input, input_len, filename, eval_flags)));
+  JSValue func = js_compile(ctx, input, input_len, filename, eval_flags);
+  if (JS_IsException(func))
+    return _CPP_NEW_JSVALUE(func);
+  return _CPP_NEW_JSVALUE(js_end_call(rt, JS_EvalFunction(ctx, func)));
+}
+
+DLLEXPORT JSValue *jsCompile(JSContext *ctx, const char *input, size_t input_len, const char *filename, int32_t eval_flags)
+{
+  JSRuntime *rt = JS_GetRuntime(ctx);
+  js_begin_call(rt);
+  return _CPP_NEW_JSVALUE(js_compile(ctx, input, input_len, filename, eval_flags));
+}
+
+DLLEXPORT JSValue *jsRunCompiled(JSContext *ctx, JSValueConst *compiled)
+{
+  JSRuntime *rt = JS_GetRuntime(ctx);
+  js_begin_call(rt);
+  return _CPP_NEW_JSVALUE(js_end_call(rt, JS_EvalFunction(ctx, JS_DupValue(ctx, *compiled))));
+}
+
+DLLEXPORT JSValue *jsParseJSON(JSContext *ctx, const char *buf, size_t len, const char *filename)
+{
+  JSRuntime *rt = JS_GetRuntime(ctx);
+  js_begin_call(rt);
+  return _CPP_NEW_JSVALUE(JS_ParseJSON(ctx, buf, len, filename));
+}
+
+DLLEXPORT int32_t jsStringifyJSON(JSContext *ctx, JSValueConst *val, int32_t indent, const char **pout, size_t *plen)
+{
+  JSRuntime *rt = JS_GetRuntime(ctx);
+  js_begin_call(rt);
+  *pout = NULL;
+  *plen = 0;
+  JSValue space = indent > 0 ? JS_NewInt32(ctx, indent) : JS_UNDEFINED;
+  JSValue str = JS_JSONStringify(ctx, *val, JS_UNDEFINED, space);
+  if (JS_IsException(str))
+    return -1;
+  if (JS_IsUndefined(str))
+    return 0;
+  *pout = JS_ToCStringLen(ctx, plen, str);
+  JS_FreeValue(ctx, str);
+  return *pout ? 0 : -1;
 }
 
 DLLEXPORT int32_t jsValueGetTag(JSValue *val)
@@ -235,34 +1915,265 @@ DLLEXPORT int32_t jsTagIsFloat64(int32_t tag)
   return JS_TAG_IS_FLOAT64(tag);
 }
 
+DLLEXPORT int32_t jsValueInspect(JSContext *ctx, JSValueConst *val, JSInspect *out)
+{
+  int32_t tag = JS_VALUE_GET_TAG(*val);
+  memset(out, 0, sizeof(JSInspect));
+  out->tag = tag;
+  if (JS_TAG_IS_FLOAT64(tag))
+  {
+    out->f64 = JS_VALUE_GET_FLOAT64(*val);
+    if (out->f64 >= -9223372036854775808.0 && out->f64 < 9223372036854775808.0)
+      out->i64 = (int64_t)out->f64;
+    return 0;
+  }
+  switch (tag)
+  {
+  case JS_TAG_INT:
+  case JS_TAG_BOOL:
+    out->i64 = JS_VALUE_GET_INT(*val);
+    out->f64 = (double)out->i64;
+    break;
+  case JS_TAG_EXCEPTION:
+    out->flags = JSInspectFlag_EXCEPTION;
+    break;
+  case JS_TAG_STRING:
+    out->str = JS_ToCStringLen(ctx, &out->str_len, *val);
+    if (out->str == NULL)
+      return -1;
+    break;
+  case JS_TAG_OBJECT:
+    if (JS_IsArray(ctx, *val) > 0)
+      out->flags |= JSInspectFlag_ARRAY;
+    if (JS_IsFunction(ctx, *val))
+      out->flags |= JSInspectFlag_FUNCTION;
+    if (JS_IsPromise(ctx, *val))
+      out->flags |= JSInspectFlag_PROMISE;
+    if (JS_IsError(ctx, *val))
+      out->flags |= JSInspectFlag_ERROR;
+    break;
+  }
+  return 0;
+}
+
 DLLEXPORT JSValue *jsNewBool(JSContext *ctx, int32_t val)
 {
   return _CPP_NEW_JSVALUE(JS_NewBool(ctx, val));
 }
 
-DLLEXPORT JSValue *jsNewInt64(JSContext *ctx, int64_t val)
+DLLEXPORT JSValue *jsNewInt64(JSContext *ctx, int64_t val)
+{
+  return _CPP_NEW_JSVALUE(JS_NewInt64(ctx, val));
+}
+
+DLLEXPORT JSValue *jsNewFloat64(JSContext *ctx, double val)
+{
+  return _CPP_NEW_JSVALUE(JS_NewFloat64(ctx, val));
+}
+
+DLLEXPORT JSValue *jsNewString(JSContext *ctx, const char *str)
+{
+  return _CPP_NEW_JSVALUE(JS_NewString(ctx, str));
+}
+
+DLLEXPORT JSValue *jsNewStringLen(JSContext *ctx, const char *str, size_t len)
+{
+  return _CPP_NEW_JSVALUE(JS_NewStringLen(ctx, str, len));
+}
+
+/* lone surrogates are kept as 3-byte sequences, which JS_NewStringLen accepts */
+DLLEXPORT JSValue *jsNewStringUTF16(JSContext *ctx, const uint16_t *str, size_t len)
+{
+  char *buf = (char *)js_malloc(ctx, len * 3 + 1);
+  if (buf == NULL)
+    return _CPP_NEW_JSVALUE(JS_EXCEPTION);
+  char *q = buf;
+  for (size_t i = 0; i < len; i++)
+  {
+    uint32_t c = str[i];
+    if (c >= 0xd800 && c < 0xdc00 && i + 1 < len && str[i + 1] >= 0xdc00 && str[i + 1] < 0xe000)
+      c = 0x10000 + ((c - 0xd800) << 10) + (str[++i] - 0xdc00);
+    if (c < 0x80)
+    {
+      *q++ = (char)c;
+    }
+    else if (c < 0x800)
+    {
+      *q++ = (char)(0xc0 | (c >> 6));
+      *q++ = (char)(0x80 | (c & 0x3f));
+    }
+    else if (c < 0x10000)
+    {
+      *q++ = (char)(0xe0 | (c >> 12));
+      *q++ = (char)(0x80 | ((c >> 6) & 0x3f));
+      *q++ = (char)(0x80 | (c & 0x3f));
+    }
+    else
+    {
+      *q++ = (char)(0xf0 | (c >> 18));
+      *q++ = (char)(0x80 | ((c >> 12) & 0x3f));
+      *q++ = (char)(0x80 | ((c >> 6) & 0x3f));
+      *q++ = (char)(0x80 | (c & 0x3f));
+    }
+  }
+  *q = '\0';
+  JSValue ret = JS_NewStringLen(ctx, buf, q - buf);
+  js_free(ctx, buf);
+  return _CPP_NEW_JSVALUE(ret);
+}
+
+DLLEXPORT JSValue *jsNewArrayBufferCopy(JSContext *ctx, const uint8_t *buf, size_t len)
+{
+  return _CPP_NEW_JSVALUE(JS_NewArrayBufferCopy(ctx, buf, len));
+}
+
+const uint8_t js_typed_array_sizes[JSTypedArrayType_COUNT] = {1, 1, 1, 2, 2, 4, 4, 8, 8, 4, 8};
+
+typedef struct
+{
+  JSHostFreeFunc *free_cb;
+  void *opaque;
+} HostBufferOpaque;
+
+void js_host_buffer_free(JSRuntime *rt, void *opaque, void *ptr)
+{
+  HostBufferOpaque *hb = (HostBufferOpaque *)opaque;
+  hb->free_cb(hb->opaque, ptr);
+  free(hb);
+}
+
+DLLEXPORT JSValue *jsNewArrayBufferExternal(JSContext *ctx, uint8_t *buf, size_t len,
+                                            JSHostFreeFunc *free_cb, void *opaque)
+{
+  if (free_cb == NULL)
+    return _CPP_NEW_JSVALUE(JS_NewArrayBuffer(ctx, buf, len, NULL, NULL, 0));
+  HostBufferOpaque *hb = (HostBufferOpaque *)malloc(sizeof(HostBufferOpaque));
+  if (hb == NULL)
+  {
+    free_cb(opaque, buf);
+    return _CPP_NEW_JSVALUE(JS_ThrowOutOfMemory(ctx));
+  }
+  hb->free_cb = free_cb;
+  hb->opaque = opaque;
+  JSValue ab = JS_NewArrayBuffer(ctx, buf, len, js_host_buffer_free, hb, 0);
+  /* quickjs does not adopt the buffer on failure */
+  if (JS_IsException(ab))
+    js_host_buffer_free(JS_GetRuntime(ctx), hb, buf);
+  return _CPP_NEW_JSVALUE(ab);
+}
+
+DLLEXPORT JSValue *jsNewTypedArrayExternal(JSContext *ctx, int32_t type, uint8_t *buf, size_t len,
+                                           JSHostFreeFunc *free_cb, void *opaque)
+{
+  if (type < 0 || type >= JSTypedArrayType_COUNT || len % js_typed_array_sizes[type])
+  {
+    if (free_cb)
+      free_cb(opaque, buf);
+    return _CPP_NEW_JSVALUE(JS_ThrowRangeError(ctx, "invalid typed array type or length"));
+  }
+  JSValue *ab = jsNewArrayBufferExternal(ctx, buf, len, free_cb, opaque);
+  if (JS_IsException(*ab))
+    return ab;
+  /* the constructor captured by jsNewContext, as scripts may have replaced the global */
+  ContextOpaque *ctx_opaque = (ContextOpaque *)JS_GetContextOpaque(ctx);
+  JSValue arr = ctx_opaque ? JS_CallConstructor(ctx, ctx_opaque->typed_array_ctors[type], 1, ab)
+                           : JS_ThrowInternalError(ctx, "typed array constructors are unavailable");
+  JS_FreeValue(ctx, *ab);
+  *ab = arr;
+  return ab;
+}
+
+DLLEXPORT JSValue *jsNewArray(JSContext *ctx)
+{
+  return _CPP_NEW_JSVALUE(JS_NewArray(ctx));
+}
+
+int js_array_length(JSContext *ctx, JSValueConst arr, int64_t *plen)
+{
+  JSValue len = JS_GetPropertyStr(ctx, arr, "length");
+  int ret = JS_ToInt64(ctx, plen, len);
+  JS_FreeValue(ctx, len);
+  /* ToLength: array-likes such as {length: -5} count as empty */
+  if (ret == 0 && *plen < 0)
+    *plen = 0;
+  return ret;
+}
+
+/*
+ * Appending index `len` with JS_PROP_C_W_E keeps a new array in quickjs's
+ * fast-array representation, and JS_GetPropertyUint32 reads fast arrays
+ * without going through the property table.
+ */
+JSValue js_array_append(JSContext *ctx, JSValue arr, uint32_t i, JSValue val)
+{
+  if (JS_DefinePropertyValueUint32(ctx, arr, i, val, JS_PROP_C_W_E) < 0)
+  {
+    JS_FreeValue(ctx, arr);
+    return JS_EXCEPTION;
+  }
+  return arr;
+}
+
+DLLEXPORT JSValue *jsNewArrayFrom(JSContext *ctx, JSValueConst *items, uint32_t n)
 {
-  return _CPP_NEW_JSVALUE(JS_NewInt64(ctx, val));
+  JSValue arr = JS_NewArray(ctx);
+  for (uint32_t i = 0; i < n && !JS_IsException(arr); i++)
+    arr = js_array_append(ctx, arr, i, JS_DupValue(ctx, items[i]));
+  return _CPP_NEW_JSVALUE(arr);
 }
 
-DLLEXPORT JSValue *jsNewFloat64(JSContext *ctx, double val)
+DLLEXPORT JSValue *jsNewArrayFromInt64(JSContext *ctx, const int64_t *items, uint32_t n)
 {
-  return _CPP_NEW_JSVALUE(JS_NewFloat64(ctx, val));
+  JSValue arr = JS_NewArray(ctx);
+  for (uint32_t i = 0; i < n && !JS_IsException(arr); i++)
+    arr = js_array_append(ctx, arr, i, JS_NewInt64(ctx, items[i]));
+  return _CPP_NEW_JSVALUE(arr);
 }
 
-DLLEXPORT JSValue *jsNewString(JSContext *ctx, const char *str)
+DLLEXPORT JSValue *jsNewArrayFromFloat64(JSContext *ctx, const double *items, uint32_t n)
 {
-  return _CPP_NEW_JSVALUE(JS_NewString(ctx, str));
+  JSValue arr = JS_NewArray(ctx);
+  for (uint32_t i = 0; i < n && !JS_IsException(arr); i++)
+    arr = js_array_append(ctx, arr, i, JS_NewFloat64(ctx, items[i]));
+  return _CPP_NEW_JSVALUE(arr);
 }
 
-DLLEXPORT JSValue *jsNewArrayBufferCopy(JSContext *ctx, const uint8_t *buf, size_t len)
+DLLEXPORT int64_t jsArrayToInt64(JSContext *ctx, JSValueConst *arr, int64_t *out, uint32_t n)
 {
-  return _CPP_NEW_JSVALUE(JS_NewArrayBufferCopy(ctx, buf, len));
+  int64_t len;
+  js_begin_call(JS_GetRuntime(ctx));
+  if (js_array_length(ctx, *arr, &len))
+    return -1;
+  if (len > n)
+    len = n;
+  for (int64_t i = 0; i < len; i++)
+  {
+    JSValue item = JS_GetPropertyUint32(ctx, *arr, (uint32_t)i);
+    int ret = JS_IsException(item) ? -1 : JS_ToInt64(ctx, &out[i], item);
+    JS_FreeValue(ctx, item);
+    if (ret)
+      return -1;
+  }
+  return len;
 }
 
-DLLEXPORT JSValue *jsNewArray(JSContext *ctx)
+DLLEXPORT int64_t jsArrayToFloat64(JSContext *ctx, JSValueConst *arr, double *out, uint32_t n)
 {
-  return _CPP_NEW_JSVALUE(JS_NewArray(ctx));
+  int64_t len;
+  js_begin_call(JS_GetRuntime(ctx));
+  if (js_array_length(ctx, *arr, &len))
+    return -1;
+  if (len > n)
+    len = n;
+  for (int64_t i = 0; i < len; i++)
+  {
+    JSValue item = JS_GetPropertyUint32(ctx, *arr, (uint32_t)i);
+    int ret = JS_IsException(item) ? -1 : JS_ToFloat64(ctx, &out[i], item);
+    JS_FreeValue(ctx, item);
+    if (ret)
+      return -1;
+  }
+  return len;
 }
 
 DLLEXPORT JSValue *jsNewObject(JSContext *ctx)
@@ -284,6 +2195,12 @@ DLLEXPORT void jsFreeValueRT(JSRuntime *rt, JSValue *v, int32_t free)
     _CPP_DELETE_JSVALUE(v);
 }
 
+DLLEXPORT void jsFreeValues(JSContext *ctx, JSValue *list, uint32_t n)
+{
+  for (uint32_t i = 0; i < n; i++)
+    JS_FreeValue(ctx, list[i]);
+}
+
 DLLEXPORT JSValue *jsDupValue(JSContext *ctx, JSValueConst *v)
 {
   return _CPP_NEW_JSVALUE(JS_DupValue(ctx, *v));
@@ -321,6 +2238,64 @@ DLLEXPORT const char *jsToCString(JSContext *ctx, JSValueConst *val)
   return ret;
 }
 
+DLLEXPORT const char *jsToCStringLen(JSContext *ctx, JSValueConst *val, size_t *plen)
+{
+  JSRuntime *rt = JS_GetRuntime(ctx);
+  js_begin_call(rt);
+  return JS_ToCStringLen(ctx, plen, *val);
+}
+
+/*
+ * CESU-8 output encodes every UTF-16 code unit separately, so each
+ * sequence maps back to exactly one unit.
+ */
+DLLEXPORT uint16_t *jsToUTF16(JSContext *ctx, JSValueConst *val, size_t *plen)
+{
+  JSRuntime *rt = JS_GetRuntime(ctx);
+  js_begin_call(rt);
+  size_t len;
+  const char *str = JS_ToCStringLen2(ctx, &len, *val, 1);
+  *plen = 0;
+  if (str == NULL)
+    return NULL;
+  uint16_t *buf = (uint16_t *)js_malloc(ctx, (len + 1) * sizeof(uint16_t));
+  if (buf == NULL)
+  {
+    JS_FreeCString(ctx, str);
+    return NULL;
+  }
+  const uint8_t *p = (const uint8_t *)str;
+  const uint8_t *end = p + len;
+  uint16_t *q = buf;
+  while (p < end)
+  {
+    uint32_t c = *p++;
+    if (c >= 0xf0 && end - p >= 3)
+    {
+      c = ((c & 0x07) << 18) | ((p[0] & 0x3f) << 12) | ((p[1] & 0x3f) << 6) | (p[2] & 0x3f);
+      p += 3;
+      c -= 0x10000;
+      *q++ = (uint16_t)(0xd800 + (c >> 10));
+      c = 0xdc00 + (c & 0x3ff);
+    }
+    else if (c >= 0xe0 && end - p >= 2)
+    {
+      c = ((c & 0x0f) << 12) | ((p[0] & 0x3f) << 6) | (p[1] & 0x3f);
+      p += 2;
+    }
+    else if (c >= 0xc0 && end - p >= 1)
+    {
+      c = ((c & 0x1f) << 6) | (p[0] & 0x3f);
+      p += 1;
+    }
+    *q++ = (uint16_t)c;
+  }
+  *q = 0;
+  JS_FreeCString(ctx, str);
+  *plen = q - buf;
+  return buf;
+}
+
 DLLEXPORT void jsFreeCString(JSContext *ctx, const char *ptr)
 {
   return JS_FreeCString(ctx, ptr);
@@ -331,6 +2306,46 @@ DLLEXPORT uint8_t *jsGetArrayBuffer(JSContext *ctx, size_t *psize, JSValueConst
   return JS_GetArrayBuffer(ctx, psize, *obj);
 }
 
+DLLEXPORT JSValue *jsGetTypedArrayView(JSContext *ctx, JSValueConst *obj, uint8_t **pptr, size_t *pbyte_len,
+                                       int32_t *pelem_type)
+{
+  *pptr = NULL;
+  *pbyte_len = 0;
+  *pelem_type = JSTypedArrayType_NONE;
+  int32_t kind = JSBuiltinClass_COUNT;
+  if (JS_IsObject(*obj))
+  {
+    JSClassID class_id = JS_GetClassID(*obj);
+    for (kind = 0; kind < JSBuiltinClass_COUNT; kind++)
+      if (js_builtin_class_id(ctx, kind) == class_id)
+        break;
+  }
+  if (kind == JSBuiltinClass_COUNT)
+    return _CPP_NEW_JSVALUE(JS_ThrowTypeError(ctx, "not an ArrayBuffer or a typed array"));
+
+  size_t offset = 0, length = 0, bytes_per_element, size;
+  JSValue buffer;
+  if (kind == JSBuiltinClass_ARRAY_BUFFER)
+    buffer = JS_DupValue(ctx, *obj);
+  else
+    buffer = JS_GetTypedArrayBuffer(ctx, *obj, &offset, &length, &bytes_per_element);
+  if (JS_IsException(buffer))
+    return _CPP_NEW_JSVALUE(buffer);
+  uint8_t *data = JS_GetArrayBuffer(ctx, &size, buffer);
+  if (data == NULL)
+  {
+    JS_FreeValue(ctx, buffer);
+    return _CPP_NEW_JSVALUE(JS_EXCEPTION);
+  }
+  if (kind == JSBuiltinClass_ARRAY_BUFFER)
+    length = size;
+  else
+    *pelem_type = kind;
+  *pptr = data + offset;
+  *pbyte_len = length;
+  return _CPP_NEW_JSVALUE(buffer);
+}
+
 DLLEXPORT int32_t jsIsFunction(JSContext *ctx, JSValueConst *val)
 {
   return JS_IsFunction(ctx, *val);
@@ -368,11 +2383,129 @@ DLLEXPORT int32_t jsDefinePropertyValue(JSContext *ctx, JSValueConst *this_obj,
   return JS_DefinePropertyValue(ctx, *this_obj, prop, *val, flags);
 }
 
+DLLEXPORT uint32_t jsGetProperties(JSContext *ctx, JSValueConst *this_obj, const JSAtom *atoms,
+                                   uint32_t n, JSValue *out)
+{
+  uint32_t i;
+  for (i = 0; i < n; i++)
+  {
+    out[i] = JS_GetProperty(ctx, *this_obj, atoms[i]);
+    if (JS_IsException(out[i]))
+      break;
+  }
+  for (uint32_t j = i + 1; j < n; j++)
+    out[j] = JS_UNDEFINED;
+  return i;
+}
+
+uint32_t js_define_properties(JSContext *ctx, JSValueConst this_obj, const JSAtom *atoms,
+                              JSValue *vals, uint32_t n, int32_t flags)
+{
+  uint32_t i;
+  for (i = 0; i < n; i++)
+  {
+    if (JS_DefinePropertyValue(ctx, this_obj, atoms[i], vals[i], flags) < 0)
+      break;
+  }
+  for (uint32_t j = i + 1; j < n; j++)
+    JS_FreeValue(ctx, vals[j]);
+  return i;
+}
+
+DLLEXPORT uint32_t jsSetProperties(JSContext *ctx, JSValueConst *this_obj, const JSAtom *atoms,
+                                   JSValue *vals, uint32_t n, int32_t flags)
+{
+  return js_define_properties(ctx, *this_obj, atoms, vals, n, flags);
+}
+
+/*
+ * quickjs shares a shape between objects whose properties were added in
+ * the same order, but it looks the shape up when the last property is
+ * added. `holder` keeps one instance alive, so the template's final shape
+ * stays registered and every instance converges on it.
+ */
+struct JSObjectTemplate
+{
+  JSValue holder;
+  uint32_t n;
+  JSAtom *atoms;
+};
+
+DLLEXPORT JSObjectTemplate *jsNewObjectTemplate(JSContext *ctx, const JSAtom *atoms, uint32_t n)
+{
+  JSObjectTemplate *tmpl = (JSObjectTemplate *)malloc(sizeof(JSObjectTemplate) + n * sizeof(JSAtom));
+  if (tmpl == NULL)
+    return NULL;
+  tmpl->n = n;
+  tmpl->atoms = (JSAtom *)(tmpl + 1);
+  for (uint32_t i = 0; i < n; i++)
+    tmpl->atoms[i] = JS_DupAtom(ctx, atoms[i]);
+  tmpl->holder = JS_NewObject(ctx);
+  for (uint32_t i = 0; i < n && !JS_IsException(tmpl->holder); i++)
+  {
+    if (JS_DefinePropertyValue(ctx, tmpl->holder, atoms[i], JS_UNDEFINED, JS_PROP_C_W_E) < 0)
+    {
+      JS_FreeValue(ctx, tmpl->holder);
+      tmpl->holder = JS_EXCEPTION;
+    }
+  }
+  if (JS_IsException(tmpl->holder))
+  {
+    jsFreeObjectTemplate(ctx, tmpl);
+    return NULL;
+  }
+  return tmpl;
+}
+
+DLLEXPORT JSValue *jsInstantiate(JSContext *ctx, JSObjectTemplate *tmpl, JSValue *vals)
+{
+  JSValue obj = JS_NewObject(ctx);
+  if (JS_IsException(obj))
+  {
+    jsFreeValues(ctx, vals, tmpl->n);
+    return _CPP_NEW_JSVALUE(obj);
+  }
+  if (js_define_properties(ctx, obj, tmpl->atoms, vals, tmpl->n, JS_PROP_C_W_E) != tmpl->n)
+  {
+    JS_FreeValue(ctx, obj);
+    obj = JS_EXCEPTION;
+  }
+  return _CPP_NEW_JSVALUE(obj);
+}
+
+DLLEXPORT void jsFreeObjectTemplate(JSContext *ctx, JSObjectTemplate *tmpl)
+{
+  JS_FreeValue(ctx, tmpl->holder);
+  for (uint32_t i = 0; i < tmpl->n; i++)
+    JS_FreeAtom(ctx, tmpl->atoms[i]);
+  free(tmpl);
+}
+
 DLLEXPORT void jsFreeAtom(JSContext *ctx, JSAtom v)
 {
   JS_FreeAtom(ctx, v);
 }
 
+DLLEXPORT JSAtom jsInternAtom(JSContext *ctx, const char *name, size_t len)
+{
+  RuntimeOpaque *opaque = (RuntimeOpaque *)JS_GetRuntimeOpaque(JS_GetRuntime(ctx));
+  if (opaque == NULL)
+    return 0;
+  StrMapEntry *e = strmap_find(&opaque->atoms, name, len);
+  if (e)
+    return (JSAtom)e->value;
+  JSAtom atom = JS_NewAtomLen(ctx, name, len);
+  if (atom == 0)
+    return 0;
+  if (strmap_put(&opaque->atoms, name, len, atom) == NULL)
+  {
+    JS_FreeAtom(ctx, atom);
+    JS_ThrowOutOfMemory(ctx);
+    return 0;
+  }
+  return atom;
+}
+
 DLLEXPORT JSAtom jsValueToAtom(JSContext *ctx, JSValueConst *val)
 {
   return JS_ValueToAtom(ctx, *val);
@@ -409,10 +2542,151 @@ DLLEXPORT JSValue *jsCall(JSContext *ctx, JSValueConst *func_obj, JSValueConst *
 {
   JSRuntime *rt = JS_GetRuntime(ctx);
   js_begin_call(rt);
-  JSValue *ret = _CPP_NEW_JSVALUE(JS_Call(ctx, *func_obj, *this_obj, argc, argv));
+  JSValue *ret = _CPP_NEW_JSVALUE(js_end_call(rt, JS_Call(ctx, *func_obj, *this_obj, argc, argv)));
   return ret;
 }
 
+#define JS_CALL_ARGS_INLINE 8
+
+JSValue js_arg_to_value(JSContext *ctx, const JSArg *arg)
+{
+  switch (arg->tag)
+  {
+  case JSArgType_NULL:
+    return JS_NULL;
+  case JSArgType_BOOL:
+    return JS_NewBool(ctx, arg->u.i64 != 0);
+  case JSArgType_INT64:
+    return JS_NewInt64(ctx, arg->u.i64);
+  case JSArgType_FLOAT64:
+    return JS_NewFloat64(ctx, arg->u.f64);
+  case JSArgType_STRING:
+    return JS_NewStringLen(ctx, arg->u.str.ptr, arg->u.str.len);
+  case JSArgType_VALUE:
+    return JS_DupValue(ctx, *arg->u.val);
+  default:
+    return JS_UNDEFINED;
+  }
+}
+
+DLLEXPORT JSValue *jsCallArgs(JSContext *ctx, JSValueConst *func_obj, JSValueConst *this_obj,
+                              int32_t argc, const JSArg *args)
+{
+  JSValue inline_argv[JS_CALL_ARGS_INLINE];
+  JSValue *argv = inline_argv;
+  if (argc > JS_CALL_ARGS_INLINE)
+  {
+    argv = (JSValue *)js_malloc(ctx, argc * sizeof(JSValue));
+    if (argv == NULL)
+      return _CPP_NEW_JSVALUE(JS_EXCEPTION);
+  }
+  int32_t i;
+  JSValue ret = JS_EXCEPTION;
+  for (i = 0; i < argc; i++)
+  {
+    argv[i] = js_arg_to_value(ctx, &args[i]);
+    if (JS_IsException(argv[i]))
+      goto done;
+  }
+  js_begin_call(JS_GetRuntime(ctx));
+  ret = js_end_call(JS_GetRuntime(ctx), JS_Call(ctx, *func_obj, *this_obj, argc, argv));
+done:
+  while (i-- > 0)
+    JS_FreeValue(ctx, argv[i]);
+  if (argv != inline_argv)
+    js_free(ctx, argv);
+  return _CPP_NEW_JSVALUE(ret);
+}
+
+/*
+ * A prepared call keeps `func`, `this` and an argv array alive across
+ * invocations, so event loops calling the same function repeatedly only
+ * update the arguments that changed.
+ */
+struct JSPreparedCall
+{
+  JSContext *ctx;
+  JSValue func;
+  JSValue this_obj;
+  int32_t argc;
+  JSValue *argv;
+};
+
+DLLEXPORT JSPreparedCall *jsPrepareCall(JSContext *ctx, JSValueConst *func_obj, JSValueConst *this_obj,
+                                        int32_t argc)
+{
+  if (argc < 0)
+    argc = 0;
+  JSPreparedCall *call = (JSPreparedCall *)malloc(sizeof(JSPreparedCall) + argc * sizeof(JSValue));
+  if (call == NULL)
+    return NULL;
+  call->ctx = ctx;
+  call->func = JS_DupValue(ctx, *func_obj);
+  call->this_obj = JS_DupValue(ctx, *this_obj);
+  call->argc = argc;
+  call->argv = (JSValue *)(call + 1);
+  for (int32_t i = 0; i < argc; i++)
+    call->argv[i] = JS_UNDEFINED;
+  return call;
+}
+
+void js_prepared_set_arg(JSPreparedCall *call, int32_t i, JSValue val)
+{
+  if (i < 0 || i >= call->argc)
+  {
+    JS_FreeValue(call->ctx, val);
+    return;
+  }
+  JS_FreeValue(call->ctx, call->argv[i]);
+  call->argv[i] = val;
+}
+
+DLLEXPORT void jsSetArgValue(JSPreparedCall *call, int32_t i, JSValueConst *val)
+{
+  js_prepared_set_arg(call, i, JS_DupValue(call->ctx, *val));
+}
+
+DLLEXPORT void jsSetArgBool(JSPreparedCall *call, int32_t i, int32_t val)
+{
+  js_prepared_set_arg(call, i, JS_NewBool(call->ctx, val));
+}
+
+DLLEXPORT void jsSetArgInt64(JSPreparedCall *call, int32_t i, int64_t val)
+{
+  js_prepared_set_arg(call, i, JS_NewInt64(call->ctx, val));
+}
+
+DLLEXPORT void jsSetArgFloat64(JSPreparedCall *call, int32_t i, double val)
+{
+  js_prepared_set_arg(call, i, JS_NewFloat64(call->ctx, val));
+}
+
+DLLEXPORT int32_t jsSetArgString(JSPreparedCall *call, int32_t i, const char *str, size_t len)
+{
+  JSValue val = JS_NewStringLen(call->ctx, str, len);
+  if (JS_IsException(val))
+    return -1;
+  js_prepared_set_arg(call, i, val);
+  return 0;
+}
+
+DLLEXPORT JSValue *jsInvokePrepared(JSPreparedCall *call)
+{
+  JSContext *ctx = call->ctx;
+  js_begin_call(JS_GetRuntime(ctx));
+  return _CPP_NEW_JSVALUE(js_end_call(JS_GetRuntime(ctx), JS_Call(ctx, call->func, call->this_obj, call->argc, call->argv)));
+}
+
+DLLEXPORT void jsFreePreparedCall(JSPreparedCall *call)
+{
+  JSContext *ctx = call->ctx;
+  JS_FreeValue(ctx, call->func);
+  JS_FreeValue(ctx, call->this_obj);
+  for (int32_t i = 0; i < call->argc; i++)
+    JS_FreeValue(ctx, call->argv[i]);
+  free(call);
+}
+
 DLLEXPORT int32_t jsIsException(JSValueConst *val)
 {
   return JS_IsException(*val);
@@ -428,15 +2702,436 @@ DLLEXPORT int32_t jsExecutePendingJob(JSRuntime *rt)
   js_begin_call(rt);
   JSContext *ctx;
   int ret = JS_ExecutePendingJob(rt, &ctx);
+  js_end_call(rt, JS_UNDEFINED);
   return ret;
 }
 
+DLLEXPORT int32_t jsExecutePendingJobs(JSRuntime *rt, int32_t max_jobs, int64_t max_ns, int32_t *executed,
+                                       JSContext **err_ctx)
+{
+  int64_t until = max_ns > 0 ? js_monotonic_ns() + max_ns : 0;
+  int32_t count = 0;
+  int ret = 0;
+  if (err_ctx)
+    *err_ctx = NULL;
+  while (max_jobs <= 0 || count < max_jobs)
+  {
+    JSContext *ctx;
+    js_begin_call(rt);
+    ret = JS_ExecutePendingJob(rt, &ctx);
+    if (ret == 0)
+      break;
+    /* a job that threw still ran */
+    count++;
+    if (ret < 0)
+    {
+      if (err_ctx)
+        *err_ctx = ctx;
+      break;
+    }
+    if (until && js_monotonic_ns() >= until)
+      break;
+  }
+  js_end_call(rt, JS_UNDEFINED);
+  if (executed)
+    *executed = count;
+  if (ret < 0)
+    return -1;
+  return JS_IsJobPending(rt) ? 1 : 0;
+}
+
 DLLEXPORT JSValue *jsNewPromiseCapability(JSContext *ctx, JSValue *resolving_funcs)
 {
   return _CPP_NEW_JSVALUE(JS_NewPromiseCapability(ctx, resolving_funcs));
 }
 
+DLLEXPORT void *jsMalloc(JSContext *ctx, size_t size)
+{
+  return js_malloc(ctx, size);
+}
+
 DLLEXPORT void jsFree(JSContext *ctx, void *ptab)
 {
   js_free(ctx, ptab);
 }
+
+typedef struct
+{
+  JSContext *ctx;
+  int32_t flags;
+  uint8_t *buf;
+  size_t len;
+  size_t cap;
+  int32_t depth;
+  void *path[JS_SERIALIZE_MAX_DEPTH];
+} JSSerializer;
+
+int js_ser_reserve(JSSerializer *s, size_t n)
+{
+  if (s->len + n <= s->cap)
+    return 0;
+  size_t cap = s->cap ? s->cap * 2 : 256;
+  while (cap < s->len + n)
+    cap *= 2;
+  uint8_t *buf = (uint8_t *)js_realloc(s->ctx, s->buf, cap);
+  if (buf == NULL)
+    return -1;
+  s->buf = buf;
+  s->cap = cap;
+  return 0;
+}
+
+int js_ser_put_u8(JSSerializer *s, uint8_t v)
+{
+  if (js_ser_reserve(s, 1))
+    return -1;
+  s->buf[s->len++] = v;
+  return 0;
+}
+
+int js_ser_put_varint(JSSerializer *s, uint64_t v)
+{
+  if (js_ser_reserve(s, 10))
+    return -1;
+  while (v >= 0x80)
+  {
+    s->buf[s->len++] = (uint8_t)(v | 0x80);
+    v >>= 7;
+  }
+  s->buf[s->len++] = (uint8_t)v;
+  return 0;
+}
+
+int js_ser_put_bytes(JSSerializer *s, const void *p, size_t n)
+{
+  if (js_ser_put_varint(s, n) || js_ser_reserve(s, n))
+    return -1;
+  memcpy(s->buf + s->len, p, n);
+  s->len += n;
+  return 0;
+}
+
+int js_ser_put_string(JSSerializer *s, JSValueConst str)
+{
+  size_t len;
+  const char *p = JS_ToCStringLen(s->ctx, &len, str);
+  if (p == NULL)
+    return -1;
+  int ret = js_ser_put_bytes(s, p, len);
+  JS_FreeCString(s->ctx, p);
+  return ret;
+}
+
+int js_ser_value(JSSerializer *s, JSValueConst val);
+
+int js_ser_array(JSSerializer *s, JSValueConst arr)
+{
+  JSContext *ctx = s->ctx;
+  int64_t len;
+  if (js_array_length(ctx, arr, &len))
+    return -1;
+  if (js_ser_put_u8(s, JSSerialTag_ARRAY) || js_ser_put_varint(s, (uint64_t)len))
+    return -1;
+  for (int64_t i = 0; i < len; i++)
+  {
+    JSValue item = JS_GetPropertyUint32(ctx, arr, (uint32_t)i);
+    if (JS_IsException(item))
+      return -1;
+    int ret = js_ser_value(s, item);
+    JS_FreeValue(ctx, item);
+    if (ret)
+      return -1;
+  }
+  return 0;
+}
+
+int js_ser_object(JSSerializer *s, JSValueConst obj)
+{
+  JSContext *ctx = s->ctx;
+  JSPropertyEnum *tab;
+  uint32_t len;
+  if (JS_GetOwnPropertyNames(ctx, &tab, &len, obj, JS_GPN_STRING_MASK | JS_GPN_ENUM_ONLY))
+    return -1;
+  int ret = js_ser_put_u8(s, JSSerialTag_OBJECT) || js_ser_put_varint(s, len) ? -1 : 0;
+  for (uint32_t i = 0; i < len && ret == 0; i++)
+  {
+    JSValue key = JS_AtomToString(ctx, tab[i].atom);
+    ret = JS_IsException(key) ? -1 : js_ser_put_string(s, key);
+    JS_FreeValue(ctx, key);
+    if (ret)
+      break;
+    JSValue item = JS_GetProperty(ctx, obj, tab[i].atom);
+    ret = JS_IsException(item) ? -1 : js_ser_value(s, item);
+    JS_FreeValue(ctx, item);
+  }
+  for (uint32_t i = 0; i < len; i++)
+    JS_FreeAtom(ctx, tab[i].atom);
+  js_free(ctx, tab);
+  return ret;
+}
+
+int js_ser_unsupported(JSSerializer *s, const char *what)
+{
+  if (s->flags & JSSerializeFlag_LENIENT)
+    return js_ser_put_u8(s, JSSerialTag_UNDEFINED);
+  JS_ThrowTypeError(s->ctx, "cannot serialize %s", what);
+  return -1;
+}
+
+int js_ser_value(JSSerializer *s, JSValueConst val)
+{
+  JSContext *ctx = s->ctx;
+  int32_t tag = JS_VALUE_GET_TAG(val);
+  if (JS_TAG_IS_FLOAT64(tag))
+  {
+    double d = JS_VALUE_GET_FLOAT64(val);
+    uint64_t bits;
+    memcpy(&bits, &d, sizeof(bits));
+    if (js_ser_put_u8(s, JSSerialTag_FLOAT64) || js_ser_reserve(s, 8))
+      return -1;
+    for (int32_t i = 0; i < 8; i++)
+      s->buf[s->len++] = (uint8_t)(bits >> (i * 8));
+    return 0;
+  }
+  switch (tag)
+  {
+  case JS_TAG_UNDEFINED:
+    return js_ser_put_u8(s, JSSerialTag_UNDEFINED);
+  case JS_TAG_NULL:
+    return js_ser_put_u8(s, JSSerialTag_NULL);
+  case JS_TAG_BOOL:
+    return js_ser_put_u8(s, JS_VALUE_GET_BOOL(val) ? JSSerialTag_TRUE : JSSerialTag_FALSE);
+  case JS_TAG_INT:
+  {
+    int64_t v = JS_VALUE_GET_INT(val);
+    if (js_ser_put_u8(s, JSSerialTag_INT))
+      return -1;
+    return js_ser_put_varint(s, ((uint64_t)v << 1) ^ (uint64_t)(v >> 63));
+  }
+  case JS_TAG_STRING:
+    if (js_ser_put_u8(s, JSSerialTag_STRING))
+      return -1;
+    return js_ser_put_string(s, val);
+  case JS_TAG_OBJECT:
+    break;
+  default:
+    return js_ser_unsupported(s, "value of this type");
+  }
+
+  if (JS_IsFunction(ctx, val))
+    return js_ser_unsupported(s, "function");
+  void *ptr = JS_VALUE_GET_PTR(val);
+  for (int32_t i = 0; i < s->depth; i++)
+  {
+    if (s->path[i] == ptr)
+    {
+      JS_ThrowTypeError(ctx, "cannot serialize circular structure");
+      return -1;
+    }
+  }
+  if (s->depth >= JS_SERIALIZE_MAX_DEPTH)
+  {
+    JS_ThrowRangeError(ctx, "serialization exceeds max depth %d", JS_SERIALIZE_MAX_DEPTH);
+    return -1;
+  }
+
+  if (JS_GetClassID(val) == js_builtin_class_id(ctx, JSBuiltinClass_ARRAY_BUFFER))
+  {
+    size_t size;
+    uint8_t *data = JS_GetArrayBuffer(ctx, &size, val);
+    if (data == NULL)
+      return -1;
+    if (js_ser_put_u8(s, JSSerialTag_ARRAY_BUFFER))
+      return -1;
+    return js_ser_put_bytes(s, data, size);
+  }
+
+  int is_array = JS_IsArray(ctx, val);
+  if (is_array < 0)
+    return -1;
+  s->path[s->depth++] = ptr;
+  int ret = is_array ? js_ser_array(s, val) : js_ser_object(s, val);
+  s->depth--;
+  return ret;
+}
+
+DLLEXPORT int32_t jsSerialize(JSContext *ctx, JSValueConst *val, int32_t flags, uint8_t **pbuf, size_t *plen)
+{
+  JSSerializer s;
+  s.ctx = ctx;
+  s.flags = flags;
+  s.buf = NULL;
+  s.len = 0;
+  s.cap = 0;
+  s.depth = 0;
+  js_begin_call(JS_GetRuntime(ctx));
+  if (js_ser_value(&s, *val))
+  {
+    js_free(ctx, s.buf);
+    *pbuf = NULL;
+    *plen = 0;
+    return -1;
+  }
+  *pbuf = s.buf;
+  *plen = s.len;
+  return 0;
+}
+
+typedef struct
+{
+  JSContext *ctx;
+  const uint8_t *p;
+  const uint8_t *end;
+  int32_t depth;
+} JSDeserializer;
+
+int js_deser_varint(JSDeserializer *s, uint64_t *pv)
+{
+  uint64_t v = 0;
+  for (int32_t shift = 0; shift < 64; shift += 7)
+  {
+    if (s->p >= s->end)
+      break;
+    uint8_t b = *s->p++;
+    v |= (uint64_t)(b & 0x7f) << shift;
+    if (!(b & 0x80))
+    {
+      *pv = v;
+      return 0;
+    }
+  }
+  JS_ThrowSyntaxError(s->ctx, "invalid serialized data");
+  return -1;
+}
+
+int js_deser_bytes(JSDeserializer *s, const uint8_t **pp, size_t *plen)
+{
+  uint64_t len;
+  if (js_deser_varint(s, &len))
+    return -1;
+  if (len > (uint64_t)(s->end - s->p))
+  {
+    JS_ThrowSyntaxError(s->ctx, "invalid serialized data");
+    return -1;
+  }
+  *pp = s->p;
+  *plen = (size_t)len;
+  s->p += len;
+  return 0;
+}
+
+JSValue js_deser_value(JSDeserializer *s)
+{
+  JSContext *ctx = s->ctx;
+  const uint8_t *data;
+  size_t len;
+  uint64_t n;
+  int is_array;
+  JSValue obj;
+  if (s->p >= s->end)
+    goto fail;
+  switch (*s->p++)
+  {
+  case JSSerialTag_UNDEFINED:
+    return JS_UNDEFINED;
+  case JSSerialTag_NULL:
+    return JS_NULL;
+  case JSSerialTag_FALSE:
+    return JS_FALSE;
+  case JSSerialTag_TRUE:
+    return JS_TRUE;
+  case JSSerialTag_INT:
+    if (js_deser_varint(s, &n))
+      return JS_EXCEPTION;
+    return JS_NewInt64(ctx, (int64_t)(n >> 1) ^ -(int64_t)(n & 1));
+  case JSSerialTag_FLOAT64:
+  {
+    if (s->end - s->p < 8)
+      goto fail;
+    uint64_t bits = 0;
+    for (int32_t i = 0; i < 8; i++)
+      bits |= (uint64_t)s->p[i] << (i * 8);
+    s->p += 8;
+    double d;
+    memcpy(&d, &bits, sizeof(d));
+    return JS_NewFloat64(ctx, d);
+  }
+  case JSSerialTag_STRING:
+    if (js_deser_bytes(s, &data, &len))
+      return JS_EXCEPTION;
+    return JS_NewStringLen(ctx, (const char *)data, len);
+  case JSSerialTag_ARRAY_BUFFER:
+    if (js_deser_bytes(s, &data, &len))
+      return JS_EXCEPTION;
+    return JS_NewArrayBufferCopy(ctx, data, len);
+  case JSSerialTag_ARRAY:
+  case JSSerialTag_OBJECT:
+    break;
+  default:
+    goto fail;
+  }
+
+  is_array = s->p[-1] == JSSerialTag_ARRAY;
+  if (s->depth >= JS_SERIALIZE_MAX_DEPTH)
+  {
+    JS_ThrowRangeError(ctx, "serialization exceeds max depth %d", JS_SERIALIZE_MAX_DEPTH);
+    return JS_EXCEPTION;
+  }
+  if (js_deser_varint(s, &n))
+    return JS_EXCEPTION;
+  if (n > (uint64_t)(s->end - s->p))
+    goto fail;
+  obj = is_array ? JS_NewArray(ctx) : JS_NewObject(ctx);
+  if (JS_IsException(obj))
+    return obj;
+  s->depth++;
+  for (uint64_t i = 0; i < n; i++)
+  {
+    JSAtom atom = 0;
+    if (!is_array)
+    {
+      if (js_deser_bytes(s, &data, &len))
+        goto fail_obj;
+      atom = JS_NewAtomLen(ctx, (const char *)data, len);
+      if (atom == 0)
+        goto fail_obj;
+    }
+    JSValue item = js_deser_value(s);
+    int ret;
+    if (JS_IsException(item))
+      ret = -1;
+    else if (is_array)
+      ret = JS_DefinePropertyValueUint32(ctx, obj, (uint32_t)i, item, JS_PROP_C_W_E);
+    else
+      ret = JS_DefinePropertyValue(ctx, obj, atom, item, JS_PROP_C_W_E);
+    if (atom)
+      JS_FreeAtom(ctx, atom);
+    if (ret < 0)
+      goto fail_obj;
+  }
+  s->depth--;
+  return obj;
+fail_obj:
+  s->depth--;
+  JS_FreeValue(ctx, obj);
+  return JS_EXCEPTION;
+fail:
+  return JS_ThrowSyntaxError(ctx, "invalid serialized data");
+}
+
+DLLEXPORT JSValue *jsDeserialize(JSContext *ctx, const uint8_t *buf, size_t len)
+{
+  JSDeserializer s;
+  s.ctx = ctx;
+  s.p = buf;
+  s.end = buf + len;
+  s.depth = 0;
+  js_begin_call(JS_GetRuntime(ctx));
+  JSValue val = js_deser_value(&s);
+  if (!JS_IsException(val) && s.p != s.end)
+  {
+    JS_FreeValue(ctx, val);
+    val = JS_ThrowSyntaxError(ctx, "invalid serialized data");
+  }
+  return _CPP_NEW_JSVALUE(val);
+}
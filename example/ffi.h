@@ -15,10 +15,100 @@ enum JSChannelType
   JSChannelType_MODULE = 1,
   JSChannelType_PROMISE_TRACK = 2,
   JSChannelType_FREE_OBJECT = 3,
+  /* argv is {JSValue *this, int *argc, JSValue *argv, uint32_t *id} */
+  JSChannelType_METHOD_ID = 4,
+  /* argv is {uint32_t *count, void **opaques}, ctx is the runtime */
+  JSChannelType_FREE_OBJECT_BATCH = 5,
+  /* argv is {uint32_t *count, JSContext **ctxs, JSValue *reasons}, ctx is the runtime */
+  JSChannelType_PROMISE_TRACK_BATCH = 6,
+  /* argv is a JSExoticRequest * */
+  JSChannelType_EXOTIC = 7,
 };
 
 typedef void *JSChannel(JSContext *ctx, size_t type, void *argv);
 
+/* clock measuring the `timeout` given to jsNewRuntime */
+enum JSDeadlineClock
+{
+  /* clock(): CPU time of the whole process, the default */
+  JSDeadlineClock_PROCESS_CPU = 0,
+  /* coarse monotonic wall clock */
+  JSDeadlineClock_MONOTONIC = 1,
+  /* CPU time of the calling thread */
+  JSDeadlineClock_THREAD_CPU = 2,
+};
+
+enum JSInspectFlag
+{
+  JSInspectFlag_ARRAY = 1 << 0,
+  JSInspectFlag_FUNCTION = 1 << 1,
+  JSInspectFlag_PROMISE = 1 << 2,
+  JSInspectFlag_ERROR = 1 << 3,
+  JSInspectFlag_EXCEPTION = 1 << 4,
+};
+
+/*
+ * Filled by jsValueInspect. Fixed-width fields only, so FFI hosts can map
+ * it as a plain struct. Numbers and booleans fill both `i64` and `f64`;
+ * `str` is set for strings and must be released with jsFreeCString.
+ */
+typedef struct JSInspect
+{
+  int32_t tag;
+  int32_t flags;
+  int64_t i64;
+  double f64;
+  const char *str;
+  size_t str_len;
+} JSInspect;
+
+typedef void JSHostFreeFunc(void *opaque, void *ptr);
+
+enum JSTypedArrayType
+{
+  JSTypedArrayType_NONE = -1,
+  JSTypedArrayType_UINT8C = 0,
+  JSTypedArrayType_INT8 = 1,
+  JSTypedArrayType_UINT8 = 2,
+  JSTypedArrayType_INT16 = 3,
+  JSTypedArrayType_UINT16 = 4,
+  JSTypedArrayType_INT32 = 5,
+  JSTypedArrayType_UINT32 = 6,
+  JSTypedArrayType_BIG_INT64 = 7,
+  JSTypedArrayType_BIG_UINT64 = 8,
+  JSTypedArrayType_FLOAT32 = 9,
+  JSTypedArrayType_FLOAT64 = 10,
+  JSTypedArrayType_COUNT,
+};
+
+enum JSArgType
+{
+  JSArgType_UNDEFINED = 0,
+  JSArgType_NULL = 1,
+  JSArgType_BOOL = 2,
+  JSArgType_INT64 = 3,
+  JSArgType_FLOAT64 = 4,
+  JSArgType_STRING = 5,
+  JSArgType_VALUE = 6,
+};
+
+/* one argument of jsCallArgs; `str` is UTF-8 and `val` is borrowed */
+typedef struct
+{
+  int32_t tag;
+  union
+  {
+    int64_t i64;
+    double f64;
+    struct
+    {
+      const char *ptr;
+      size_t len;
+    } str;
+    JSValue *val;
+  } u;
+} JSArg;
+
 DLLEXPORT JSValue *jsThrow(JSContext *ctx, JSValue *obj);
 
 DLLEXPORT JSValue *jsEXCEPTION();
@@ -29,12 +119,152 @@ DLLEXPORT JSValue *jsNULL();
 
 DLLEXPORT JSRuntime *jsNewRuntime(JSChannel channel, int64_t timeout);
 
+/*
+ * Process-wide cache of compiled module bytecode, keyed by module name and
+ * source hash and shared by every runtime. Both are off by default:
+ * `max_bytes` bounds the in-memory LRU and `dir` (NULL to disable) keeps
+ * bytecode files that later processes map instead of parsing. Files are
+ * only reused by the same engine build and are checksummed against
+ * corruption, but `dir` must not be writable by untrusted users.
+ */
+DLLEXPORT void jsSetModuleCacheCapacity(size_t max_bytes);
+
+DLLEXPORT void jsSetModuleCacheDir(const char *dir);
+
+#define JS_BUNDLE_MAGIC "QJSB"
+#define JS_BUNDLE_VERSION 1
+
+/*
+ * Precompiled module bundle, little endian:
+ *
+ *   JSBundleHeader
+ *   JSBundleEntry[count], sorted bytewise by module name
+ *   module names, concatenated without terminators
+ *   module bytecode, as written by JS_WriteObject(JS_WRITE_OBJ_BYTECODE)
+ *
+ * Offsets are relative to the start of the file.
+ */
+typedef struct
+{
+  char magic[4];
+  uint32_t version;
+  uint32_t count;
+  uint32_t reserved;
+} JSBundleHeader;
+
+typedef struct
+{
+  uint64_t name_offset;
+  uint64_t data_offset;
+  uint32_t name_len;
+  uint32_t data_len;
+} JSBundleEntry;
+
+/*
+ * Map a bundle file into the runtime. Imports found in a registered bundle
+ * are read from the mapping without calling the host channel; bundles
+ * registered later take precedence. Returns -1 for a malformed bundle,
+ * including one whose entries are not sorted.
+ */
+DLLEXPORT int32_t jsRegisterBundle(JSRuntime *rt, const char *path);
+
+/* serialize a compiled script or module; the result is released with jsFree */
+DLLEXPORT uint8_t *jsWriteBytecode(JSContext *ctx, JSValueConst *val, size_t *plen);
+
+typedef struct
+{
+  const char *name;
+  JSCFunction *func;
+  int32_t length;
+} JSNativeFunction;
+
+/*
+ * Register a module whose exports are plain C functions, called by the
+ * interpreter without going through the channel. Native modules take
+ * precedence over bundles and the channel; the table is copied. Returns
+ * -1 for a NULL name or function, a length above 255 or a duplicate name.
+ */
+DLLEXPORT int32_t jsRegisterNativeModule(JSRuntime *rt, const char *module_name,
+                                         const JSNativeFunction *funcs, uint32_t count);
+
+/*
+ * Classes are registered once per name and hooks: later calls with the
+ * same arguments, from any runtime, return the same class id, while other
+ * hooks get a class of their own. `exotic` is copied.
+ */
+DLLEXPORT uint32_t jsNewClassEx(JSContext *ctx, const char *name, JSClassGCMark *gc_mark,
+                                const JSClassExoticMethods *exotic);
+
 DLLEXPORT uint32_t jsNewClass(JSContext *ctx, const char *name);
 
+enum JSExoticOp
+{
+  /* own property lookup: set `found` and, when found, `value` */
+  JSExoticOp_GET = 0,
+  /* own property test: set `found` */
+  JSExoticOp_HAS = 1,
+  /* own property names: set `keys` and `key_count` */
+  JSExoticOp_KEYS = 2,
+};
+
+/*
+ * Property request on an object of a jsNewClassExotic class. The host
+ * sets `found` to -1 after throwing. `value` is handed over to the engine;
+ * `keys` is allocated with jsMalloc and released by the engine, while the
+ * atoms in it (distinct, e.g. from jsInternAtom) stay owned by the host.
+ */
+typedef struct
+{
+  int32_t op;
+  JSAtom atom;
+  void *opaque;
+  int32_t found;
+  JSValue value;
+  JSAtom *keys;
+  uint32_t key_count;
+} JSExoticRequest;
+
+/*
+ * Class whose own properties are served lazily by the host through
+ * JSChannelType_EXOTIC; they are enumerable and read-only. Missing
+ * properties fall back to the prototype.
+ */
+DLLEXPORT uint32_t jsNewClassExotic(JSContext *ctx, const char *name);
+
+/*
+ * Queue finalizer and unhandled rejection events, starting with room for
+ * `capacity` (grown as needed), instead of calling the channel for each
+ * one. The channel is never called from inside GC: a queue that reached
+ * `high_water` (capacity when 0) is delivered as one *_BATCH call when
+ * jsEval, jsRunCompiled, jsCall*, jsInvokePrepared or jsExecutePendingJob*
+ * returns. Hosts that poll with jsDrain* before that get no calls. Queued
+ * events are also delivered by jsFreeContext, jsFreeRuntime and
+ * reconfiguration. Off (0) by default.
+ */
+DLLEXPORT int32_t jsSetNotificationBatching(JSRuntime *rt, uint32_t capacity, uint32_t high_water);
+
+/* returns the number of opaques moved to `out` */
+DLLEXPORT uint32_t jsDrainFinalizers(JSRuntime *rt, void **out, uint32_t n);
+
+/* the caller owns the returned reasons and frees them with jsFreeValueRT */
+DLLEXPORT uint32_t jsDrainRejections(JSRuntime *rt, JSValue *reasons, JSContext **ctxs, uint32_t n);
+
 DLLEXPORT void *jsGetObjectOpaque(JSValue *obj, uint32_t classid);
 
 DLLEXPORT JSValue *jsNewObjectClass(JSContext *ctx, uint32_t QJSClassId, void *opaque);
 
+/* read the clock only on every `check_stride`-th interrupt poll */
+DLLEXPORT void jsSetDeadlineMode(JSRuntime *rt, int32_t deadline_clock, uint32_t check_stride);
+
+/*
+ * Safe to call from any thread. The running script is stopped with an
+ * uncatchable error at its next interrupt poll. A request made while no
+ * script is running stays pending until it fires or jsClearInterrupt.
+ */
+DLLEXPORT void jsRequestInterrupt(JSRuntime *rt);
+
+DLLEXPORT void jsClearInterrupt(JSRuntime *rt);
+
 DLLEXPORT void jsSetMaxStackSize(JSRuntime *rt, size_t stack_size);
 
 DLLEXPORT void jsSetMemoryLimit(JSRuntime *rt, size_t limit);
@@ -43,6 +273,9 @@ DLLEXPORT void jsFreeRuntime(JSRuntime *rt);
 
 DLLEXPORT JSValue *jsNewCFunction(JSContext *ctx, JSValue *funcData);
 
+/* host function dispatched as JSChannelType_METHOD_ID with an integer id instead of a JS value */
+DLLEXPORT JSValue *jsNewCFunctionId(JSContext *ctx, uint32_t id, int32_t argc);
+
 DLLEXPORT JSValue *jsGetGlobalObject(JSContext *ctx);
 
 DLLEXPORT JSContext *jsNewContext(JSRuntime *rt);
@@ -53,12 +286,37 @@ DLLEXPORT JSRuntime *jsGetRuntime(JSContext *ctx);
 
 DLLEXPORT JSValue *jsEval(JSContext *ctx, const char *input, size_t input_len, const char *filename, int32_t eval_flags);
 
+/*
+ * Compile without running; the handle is run any number of times with
+ * jsRunCompiled (a module only evaluates once) and released with jsFreeValue.
+ */
+DLLEXPORT JSValue *jsCompile(JSContext *ctx, const char *input, size_t input_len, const char *filename, int32_t eval_flags);
+
+DLLEXPORT JSValue *jsRunCompiled(JSContext *ctx, JSValueConst *compiled);
+
+/*
+ * Keep up to `capacity` compiled global scripts per runtime so that jsEval
+ * and jsCompile skip parsing repeated sources. Off (0) by default.
+ */
+DLLEXPORT void jsSetEvalCacheCapacity(JSRuntime *rt, uint32_t capacity);
+
+/* like jsEval, `buf[len]` must be '\0' */
+DLLEXPORT JSValue *jsParseJSON(JSContext *ctx, const char *buf, size_t len, const char *filename);
+
+/*
+ * `*pout` is released with jsFreeCString and stays NULL when the value has
+ * no JSON form (e.g. undefined). Returns -1 on exception.
+ */
+DLLEXPORT int32_t jsStringifyJSON(JSContext *ctx, JSValueConst *val, int32_t indent, const char **pout, size_t *plen);
+
 DLLEXPORT int32_t jsValueGetTag(JSValue *val);
 
 DLLEXPORT void *jsValueGetPtr(JSValue *val);
 
 DLLEXPORT int32_t jsTagIsFloat64(int32_t tag);
 
+DLLEXPORT int32_t jsValueInspect(JSContext *ctx, JSValueConst *val, JSInspect *out);
+
 DLLEXPORT JSValue *jsNewBool(JSContext *ctx, int32_t val);
 
 DLLEXPORT JSValue *jsNewInt64(JSContext *ctx, int64_t val);
@@ -67,16 +325,47 @@ DLLEXPORT JSValue *jsNewFloat64(JSContext *ctx, double val);
 
 DLLEXPORT JSValue *jsNewString(JSContext *ctx, const char *str);
 
+DLLEXPORT JSValue *jsNewStringLen(JSContext *ctx, const char *str, size_t len);
+
+DLLEXPORT JSValue *jsNewStringUTF16(JSContext *ctx, const uint16_t *str, size_t len);
+
 DLLEXPORT JSValue *jsNewArrayBufferCopy(JSContext *ctx, const uint8_t *buf, size_t len);
 
+/*
+ * Wrap host memory without copying. `free_cb` is called exactly once, from
+ * the thread running the runtime, when the buffer is collected or if the
+ * call fails. With a NULL `free_cb` the host must keep `buf` alive for the
+ * lifetime of the runtime.
+ */
+DLLEXPORT JSValue *jsNewArrayBufferExternal(JSContext *ctx, uint8_t *buf, size_t len,
+                                            JSHostFreeFunc *free_cb, void *opaque);
+
+/* same as jsNewArrayBufferExternal, returning a typed array over the whole buffer */
+DLLEXPORT JSValue *jsNewTypedArrayExternal(JSContext *ctx, int32_t type, uint8_t *buf, size_t len,
+                                           JSHostFreeFunc *free_cb, void *opaque);
+
 DLLEXPORT JSValue *jsNewArray(JSContext *ctx);
 
+/* `items` are borrowed; each element is duplicated into the new array */
+DLLEXPORT JSValue *jsNewArrayFrom(JSContext *ctx, JSValueConst *items, uint32_t n);
+
+DLLEXPORT JSValue *jsNewArrayFromInt64(JSContext *ctx, const int64_t *items, uint32_t n);
+
+DLLEXPORT JSValue *jsNewArrayFromFloat64(JSContext *ctx, const double *items, uint32_t n);
+
+/* copy at most `n` leading elements into `out`; returns the count copied or -1 on exception */
+DLLEXPORT int64_t jsArrayToInt64(JSContext *ctx, JSValueConst *arr, int64_t *out, uint32_t n);
+
+DLLEXPORT int64_t jsArrayToFloat64(JSContext *ctx, JSValueConst *arr, double *out, uint32_t n);
+
 DLLEXPORT JSValue *jsNewObject(JSContext *ctx);
 
 DLLEXPORT void jsFreeValue(JSContext *ctx, JSValue *v, int32_t free);
 
 DLLEXPORT void jsFreeValueRT(JSRuntime *rt, JSValue *v, int32_t free);
 
+DLLEXPORT void jsFreeValues(JSContext *ctx, JSValue *list, uint32_t n);
+
 DLLEXPORT JSValue *jsDupValue(JSContext *ctx, JSValueConst *v);
 
 DLLEXPORT JSValue *jsDupValueRT(JSRuntime *rt, JSValue *v);
@@ -89,10 +378,24 @@ DLLEXPORT double jsToFloat64(JSContext *ctx, JSValueConst *val);
 
 DLLEXPORT const char *jsToCString(JSContext *ctx, JSValueConst *val);
 
+DLLEXPORT const char *jsToCStringLen(JSContext *ctx, JSValueConst *val, size_t *plen);
+
+/* NUL-terminated UTF-16 copy, released with jsFree */
+DLLEXPORT uint16_t *jsToUTF16(JSContext *ctx, JSValueConst *val, size_t *plen);
+
 DLLEXPORT void jsFreeCString(JSContext *ctx, const char *ptr);
 
 DLLEXPORT uint8_t *jsGetArrayBuffer(JSContext *ctx, size_t *psize, JSValueConst *obj);
 
+/*
+ * Point `*pptr` at the bytes viewed by an ArrayBuffer or a typed array,
+ * honouring the view's byte offset. `*pelem_type` is JSTypedArrayType_NONE
+ * for a plain ArrayBuffer. The returned backing ArrayBuffer keeps the
+ * memory alive until it is released with jsFreeValue.
+ */
+DLLEXPORT JSValue *jsGetTypedArrayView(JSContext *ctx, JSValueConst *obj, uint8_t **pptr, size_t *pbyte_len,
+                                       int32_t *pelem_type);
+
 DLLEXPORT int32_t jsIsFunction(JSContext *ctx, JSValueConst *val);
 
 DLLEXPORT int32_t jsIsPromise(JSContext *ctx, JSValueConst *val);
@@ -109,8 +412,41 @@ DLLEXPORT JSValue *jsGetProperty(JSContext *ctx, JSValueConst *this_obj,
 DLLEXPORT int32_t jsDefinePropertyValue(JSContext *ctx, JSValueConst *this_obj,
                                         JSAtom prop, JSValue *val, int32_t flags);
 
+/*
+ * Read `n` properties into caller-provided storage. Returns `n` on
+ * success, otherwise the index of the first failing property: that slot
+ * holds JS_EXCEPTION and the remaining slots are undefined, so `out` can
+ * always be released with jsFreeValues.
+ */
+DLLEXPORT uint32_t jsGetProperties(JSContext *ctx, JSValueConst *this_obj, const JSAtom *atoms,
+                                   uint32_t n, JSValue *out);
+
+/*
+ * Define `n` properties, taking ownership of every value in `vals` like
+ * jsDefinePropertyValue. Returns `n` on success, otherwise the index of
+ * the first failing property.
+ */
+DLLEXPORT uint32_t jsSetProperties(JSContext *ctx, JSValueConst *this_obj, const JSAtom *atoms,
+                                   JSValue *vals, uint32_t n, int32_t flags);
+
+typedef struct JSObjectTemplate JSObjectTemplate;
+
+DLLEXPORT JSObjectTemplate *jsNewObjectTemplate(JSContext *ctx, const JSAtom *atoms, uint32_t n);
+
+/* `vals` holds one value per template atom; ownership moves to the new object */
+DLLEXPORT JSValue *jsInstantiate(JSContext *ctx, JSObjectTemplate *tmpl, JSValue *vals);
+
+DLLEXPORT void jsFreeObjectTemplate(JSContext *ctx, JSObjectTemplate *tmpl);
+
 DLLEXPORT void jsFreeAtom(JSContext *ctx, JSAtom v);
 
+/*
+ * Return the atom for a UTF-8 name from a per-runtime table. Interned atoms
+ * are owned by the runtime and stay valid until jsFreeRuntime; do not pass
+ * them to jsFreeAtom. Returns 0 on failure.
+ */
+DLLEXPORT JSAtom jsInternAtom(JSContext *ctx, const char *name, size_t len);
+
 DLLEXPORT JSAtom jsValueToAtom(JSContext *ctx, JSValueConst *val);
 
 DLLEXPORT JSValue *jsAtomToValue(JSContext *ctx, JSAtom val);
@@ -127,12 +463,87 @@ DLLEXPORT void setJSValueList(JSValue *list, uint32_t i, JSValue *val);
 DLLEXPORT JSValue *jsCall(JSContext *ctx, JSValueConst *func_obj, JSValueConst *this_obj,
                           int32_t argc, JSValueConst *argv);
 
+DLLEXPORT JSValue *jsCallArgs(JSContext *ctx, JSValueConst *func_obj, JSValueConst *this_obj,
+                              int32_t argc, const JSArg *args);
+
+typedef struct JSPreparedCall JSPreparedCall;
+
+DLLEXPORT JSPreparedCall *jsPrepareCall(JSContext *ctx, JSValueConst *func_obj, JSValueConst *this_obj,
+                                        int32_t argc);
+
+DLLEXPORT void jsSetArgValue(JSPreparedCall *call, int32_t i, JSValueConst *val);
+
+DLLEXPORT void jsSetArgBool(JSPreparedCall *call, int32_t i, int32_t val);
+
+DLLEXPORT void jsSetArgInt64(JSPreparedCall *call, int32_t i, int64_t val);
+
+DLLEXPORT void jsSetArgFloat64(JSPreparedCall *call, int32_t i, double val);
+
+DLLEXPORT int32_t jsSetArgString(JSPreparedCall *call, int32_t i, const char *str, size_t len);
+
+DLLEXPORT JSValue *jsInvokePrepared(JSPreparedCall *call);
+
+DLLEXPORT void jsFreePreparedCall(JSPreparedCall *call);
+
 DLLEXPORT int32_t jsIsException(JSValueConst *val);
 
 DLLEXPORT JSValue *jsGetException(JSContext *ctx);
 
 DLLEXPORT int32_t jsExecutePendingJob(JSRuntime *rt);
 
+/*
+ * Run queued jobs until the queue is empty, `max_jobs` jobs have run or
+ * `max_ns` nanoseconds have elapsed (a value <= 0 disables that limit).
+ * Each job gets its own timeout. Returns 1 if jobs remain, 0 if the queue
+ * is empty, or -1 if a job threw, in which case `*err_ctx` holds the
+ * context with the pending exception. `*executed` counts the jobs that ran,
+ * including one that threw. `executed` and `err_ctx` may be NULL.
+ */
+DLLEXPORT int32_t jsExecutePendingJobs(JSRuntime *rt, int32_t max_jobs, int64_t max_ns, int32_t *executed,
+                                       JSContext **err_ctx);
+
 DLLEXPORT JSValue *jsNewPromiseCapability(JSContext *ctx, JSValue *resolving_funcs);
 
+DLLEXPORT void *jsMalloc(JSContext *ctx, size_t size);
+
 DLLEXPORT void jsFree(JSContext *ctx, void *ptab);
+
+#ifndef JS_SERIALIZE_MAX_DEPTH
+#define JS_SERIALIZE_MAX_DEPTH 128
+#endif
+
+/*
+ * jsSerialize output: one value, encoded as a tag byte followed by its
+ * payload. Lengths and counts are unsigned LEB128 varints.
+ *
+ *   UNDEFINED, NULL, FALSE, TRUE   no payload
+ *   INT                            zigzag varint
+ *   FLOAT64                        8 bytes, little endian IEEE 754
+ *   STRING, ARRAY_BUFFER           varint byte length, bytes (UTF-8)
+ *   ARRAY                          varint count, values
+ *   OBJECT                         varint count, (STRING-style key, value)*
+ */
+enum JSSerialTag
+{
+  JSSerialTag_UNDEFINED = 0,
+  JSSerialTag_NULL = 1,
+  JSSerialTag_FALSE = 2,
+  JSSerialTag_TRUE = 3,
+  JSSerialTag_INT = 4,
+  JSSerialTag_FLOAT64 = 5,
+  JSSerialTag_STRING = 6,
+  JSSerialTag_ARRAY = 7,
+  JSSerialTag_OBJECT = 8,
+  JSSerialTag_ARRAY_BUFFER = 9,
+};
+
+enum JSSerializeFlag
+{
+  /* write functions, symbols and bigints as undefined instead of throwing */
+  JSSerializeFlag_LENIENT = 1 << 0,
+};
+
+/* `*pbuf` is released with jsFree */
+DLLEXPORT int32_t jsSerialize(JSContext *ctx, JSValueConst *val, int32_t flags, uint8_t **pbuf, size_t *plen);
+
+DLLEXPORT JSValue *jsDeserialize(JSContext *ctx, const uint8_t *buf, size_t len);
@@ -29,6 +29,7 @@ __all__ = [
     "auto_decode_bytes",
     "text_to_b64",
     "b64_to_text",
+    "qjs_bundle",
 ]
 
 _os_map: dict[str, Literal["windows", "linux", "macos"]] = {
@@ -537,6 +538,166 @@ def log(
     print("\033[0m", end="")
 
 
+_JS_EVAL_TYPE_MODULE = 1 << 0
+_JS_EVAL_FLAG_COMPILE_ONLY = 1 << 5
+
+
+class _QJSCompiler:
+    """
+    Drives a `libquickjs` built by `example/make` through ctypes.
+    """
+
+    def __init__(self, lib: Path):
+        import ctypes
+
+        self.ctypes = ctypes
+        self.lib = L = ctypes.CDLL(lib.absolute().as_posix())
+        ptr = ctypes.c_void_p
+        channel_t = ctypes.CFUNCTYPE(ptr, ptr, ctypes.c_size_t, ptr)
+        L.jsNewRuntime.restype = ptr
+        L.jsNewRuntime.argtypes = [channel_t, ctypes.c_int64]
+        L.jsNewContext.restype = ptr
+        L.jsNewContext.argtypes = [ptr]
+        L.jsEval.restype = ptr
+        L.jsEval.argtypes = [ptr, ctypes.c_char_p, ctypes.c_size_t, ctypes.c_char_p, ctypes.c_int32]
+        L.jsIsException.restype = ctypes.c_int32
+        L.jsIsException.argtypes = [ptr]
+        L.jsGetException.restype = ptr
+        L.jsGetException.argtypes = [ptr]
+        L.jsToCString.restype = ptr
+        L.jsToCString.argtypes = [ptr, ptr]
+        L.jsFreeCString.argtypes = [ptr, ptr]
+        L.jsWriteBytecode.restype = ptr
+        L.jsWriteBytecode.argtypes = [ptr, ptr, ctypes.POINTER(ctypes.c_size_t)]
+        L.jsFreeValue.argtypes = [ptr, ptr, ctypes.c_int32]
+        L.jsFree.argtypes = [ptr, ptr]
+        # compile-only evaluation never imports, so the channel is never called
+        self.channel = channel_t(lambda ctx, type, argv: None)
+        self.rt = L.jsNewRuntime(self.channel, 0)
+        self.ctx = L.jsNewContext(self.rt)
+
+    def compile(self, source: bytes, module_name: str) -> bytes:
+        L, ctx = self.lib, self.ctx
+        val = L.jsEval(
+            ctx,
+            source,
+            len(source),
+            module_name.encode("utf-8"),
+            _JS_EVAL_TYPE_MODULE | _JS_EVAL_FLAG_COMPILE_ONLY,
+        )
+        try:
+            if L.jsIsException(val):
+                exc = L.jsGetException(ctx)
+                msg = L.jsToCString(ctx, exc)
+                text = self.ctypes.string_at(msg).decode("utf-8", "replace")
+                L.jsFreeCString(ctx, msg)
+                L.jsFreeValue(ctx, exc, 1)
+                raise SyntaxError(f"{module_name}: {text}")
+            size = self.ctypes.c_size_t()
+            buf = L.jsWriteBytecode(ctx, val, self.ctypes.byref(size))
+            if not buf:
+                raise MemoryError(f"{module_name}: cannot serialize bytecode")
+            data = self.ctypes.string_at(buf, size.value)
+            L.jsFree(ctx, buf)
+            return data
+        finally:
+            L.jsFreeValue(ctx, val, 1)
+
+
+_qjs_compilers: dict[str, _QJSCompiler] = {}
+
+
+def _get_qjs_compiler(lib: Path):
+    key = lib.absolute().as_posix()
+    compiler = _qjs_compilers.get(key)
+    if compiler is None:
+        _qjs_compilers[key] = compiler = _QJSCompiler(lib)
+    return compiler
+
+
+def _write_qjs_bundle(path: Path, modules: list[tuple[bytes, bytes]]):
+    """
+    Write the bundle layout read by `jsRegisterBundle` (see `example/ffi.h`).
+    """
+    import struct
+
+    modules = sorted(modules, key=lambda m: m[0])
+    names = b"".join(name for name, _ in modules)
+    name_offset = 16 + 24 * len(modules)
+    data_offset = name_offset + len(names)
+    index = []
+    for name, data in modules:
+        index.append(struct.pack("<QQII", name_offset, data_offset, len(name), len(data)))
+        name_offset += len(name)
+        data_offset += len(data)
+    path.parent.mkdir(parents=True, exist_ok=True)
+    with path.open("wb") as f:
+        f.write(struct.pack("<4sIII", b"QJSB", 1, len(modules), 0))
+        f.write(b"".join(index))
+        f.write(names)
+        for _, data in modules:
+            f.write(data)
+
+
+def qjs_bundle(
+    src_dir: str | Path,
+    bundle: str | Path,
+    *,
+    lib: str | Path,
+    out_dir: str | Path | None = None,
+    prefix: str = "",
+    deps: list[str] | None = None,
+):
+    """
+    Register recipes that compile every `.js`/`.mjs` file under `src_dir` to QuickJS bytecode,
+    one cached recipe per module, and a recipe named `bundle` that packs them into a bundle file
+    for `jsRegisterBundle`.
+
+    - `lib`: the `libquickjs` shared library built by `example/make`.
+    - `out_dir`: where per-module bytecode goes, `<bundle>.d` by default.
+    - `prefix`: prepended to each module name; names are otherwise the posix paths relative to `src_dir`,
+        which is how QuickJS resolves relative imports between them.
+    - `deps`: extra dependencies of every compile recipe besides its source and `lib`.
+
+    Only modules whose source changed are recompiled, or all of them when `lib` is rebuilt,
+    as bytecode is not portable across engine builds.
+    """
+    src_root = Path(src_dir)
+    bundle_path = Path(bundle)
+    out_root = Path(out_dir) if out_dir is not None else Path(f"{bundle_path.as_posix()}.d")
+    lib_path = Path(lib)
+    extra_deps = list(deps or [])
+
+    artifacts: list[tuple[str, str]] = []
+    for src in sorted(src_root.rglob("*")):
+        if src.suffix not in (".js", ".mjs") or not src.is_file():
+            continue
+        rel = src.relative_to(src_root).as_posix()
+        artifact = out_root.joinpath(rel + ".qjsbc")
+        module_name = prefix + rel
+        artifacts.append((module_name, artifact.as_posix()))
+
+        def compile_module(src: Path = src, artifact: Path = artifact, module_name: str = module_name):
+            log(f"compiling {module_name}", "info")
+            try:
+                data = _get_qjs_compiler(lib_path).compile(src.read_bytes(), module_name)
+            except (SyntaxError, MemoryError) as e:
+                log(str(e), "error")
+                sys.exit(1)
+            artifact.parent.mkdir(parents=True, exist_ok=True)
+            artifact.write_bytes(data)
+
+        recipe(src.as_posix(), lib_path.as_posix(), *extra_deps, name=artifact.as_posix())(compile_module)
+
+    def pack_bundle():
+        modules = [(name.encode("utf-8"), Path(artifact).read_bytes()) for name, artifact in artifacts]
+        _write_qjs_bundle(bundle_path, modules)
+        log(f"packed {len(modules)} modules into {bundle_path.as_posix()}", "ok")
+
+    recipe(*[artifact for _, artifact in artifacts], name=bundle_path.as_posix())(pack_bundle)
+    return bundle_path.as_posix()
+
+
 def import_from_source_file(path: Path, module_name: str):
     import importlib.util
 